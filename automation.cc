@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "automation.h"
+#include "peaklim.h"
+
+Automation::Automation (void)
+	: _pts (0)
+	, _n (0)
+	, _next (0)
+	, _gain_offset (0)
+{
+}
+
+Automation::~Automation (void)
+{
+	free (_pts);
+}
+
+double
+Automation::parse_time (const char* s)
+{
+	double t = 0;
+	for (int i = 0; i < 3; ++i) {
+		char*  end;
+		double v = strtod (s, &end);
+		if (end == s || v < 0) {
+			return -1;
+		}
+		t = 60 * t + v;
+		if (*end == '\0') {
+			return t;
+		}
+		if (*end != ':' || v != floor (v)) {
+			return -1;
+		}
+		s = end + 1;
+	}
+	return -1;
+}
+
+static bool
+parse_point (char* line, double rate, int chunk, Automation::Point* pt)
+{
+	char* tok[4];
+	int   n = 0;
+	for (char* t = strtok (line, " \t\r\n"); t && n < 4; t = strtok (0, " \t\r\n")) {
+		tok[n++] = t;
+	}
+	if (n != 3) {
+		return false;
+	}
+
+	double t = Automation::parse_time (tok[0]);
+	if (t < 0) {
+		return false;
+	}
+
+	char* end;
+	float v = strtof (tok[2], &end);
+	if (end == tok[2] || *end != '\0') {
+		return false;
+	}
+
+	if (!strcmp (tok[1], "input-gain")) {
+		pt->param = Automation::INPUT_GAIN;
+		if (v < -10 || v > 30) {
+			return false;
+		}
+	} else if (!strcmp (tok[1], "threshold")) {
+		pt->param = Automation::THRESHOLD;
+		if (v < -10 || v > 0) {
+			return false;
+		}
+	} else if (!strcmp (tok[1], "release")) {
+		pt->param = Automation::RELEASE;
+		if (v < 1 || v > 1000) {
+			return false;
+		}
+	} else {
+		return false;
+	}
+
+	/* Peaklim takes parameter changes per chunk */
+	int64_t f = llround (t * rate);
+	pt->frame = ((f + chunk / 2) / chunk) * chunk;
+	pt->value = v;
+	return true;
+}
+
+static bool
+point_before (Automation::Point const& a, Automation::Point const& b)
+{
+	return a.frame < b.frame;
+}
+
+int
+Automation::load (const char* path, double rate, int chunk)
+{
+	FILE* f = fopen (path, "r");
+	if (!f) {
+		return -1;
+	}
+
+	free (_pts);
+	_pts  = 0;
+	_n    = 0;
+	_next = 0;
+
+	size_t alloc  = 0;
+	int    lineno = 0;
+	int    rv     = 0;
+	char   line[1024];
+
+	while (fgets (line, sizeof (line), f)) {
+		++lineno;
+		char* c = strchr (line, '#');
+		if (c) {
+			*c = '\0';
+		}
+		if (strspn (line, " \t\r\n") == strlen (line)) {
+			continue;
+		}
+		if (_n == alloc) {
+			alloc    = alloc ? 2 * alloc : 64;
+			Point* p = (Point*)realloc (_pts, alloc * sizeof (Point));
+			if (!p) {
+				free (_pts);
+				_pts = 0;
+				_n   = 0;
+				rv   = -1;
+				break;
+			}
+			_pts = p;
+		}
+		if (!parse_point (line, rate, chunk, &_pts[_n])) {
+			rv = lineno;
+			break;
+		}
+		++_n;
+	}
+	fclose (f);
+
+	/* breakpoints at the same time remain in file order */
+	std::stable_sort (_pts, _pts + _n, point_before);
+	return rv;
+}
+
+void
+Automation::set_gain_offset (float db)
+{
+	_gain_offset = db;
+}
+
+int
+Automation::apply (Peaklim& p, int64_t pos, int nframes)
+{
+	while (_next < _n && _pts[_next].frame <= pos) {
+		Point const& pt = _pts[_next++];
+		switch (pt.param) {
+			case INPUT_GAIN:
+				/* ramped over the next gain-update period */
+				p.set_inpgain (pt.value + _gain_offset);
+				break;
+			case THRESHOLD:
+				p.set_threshold (pt.value);
+				break;
+			case RELEASE:
+				p.set_release (pt.value / 1000.f);
+				break;
+		}
+	}
+	if (_next < _n && _pts[_next].frame - pos < nframes) {
+		return _pts[_next].frame - pos;
+	}
+	return nframes;
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _AUTOMATION_H
+#define _AUTOMATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Peaklim;
+
+/* Time-stamped parameter changes, read from a text file with one
+ * `time parameter value` breakpoint per line:
+ *
+ *   0:00     threshold  -1
+ *   1:30.5   input-gain 4
+ *   1:30.5   release    50  # ms
+ *
+ * Values use the same units and limits as the command-line options.
+ */
+class Automation
+{
+public:
+	enum Param {
+		INPUT_GAIN = 0,
+		THRESHOLD,
+		RELEASE
+	};
+
+	struct Point {
+		int64_t frame;
+		Param   param;
+		float   value;
+	};
+
+	Automation (void);
+	~Automation (void);
+
+	/* Parse a file, times are rounded to a multiple of `chunk` frames.
+	 * Returns 0 on success, -1 if the file cannot be read or on
+	 * allocation failure, otherwise the number of the first invalid line.
+	 */
+	int load (const char* path, double rate, int chunk);
+
+	/* added to input-gain values, e.g. by auto-gain */
+	void set_gain_offset (float db);
+
+	size_t
+	size () const
+	{
+		return _n;
+	}
+
+	Point const&
+	operator[] (size_t i) const
+	{
+		return _pts[i];
+	}
+
+	/* Apply all breakpoints up to frame `pos`, and return the number
+	 * of frames until the next one, at most `nframes`.
+	 */
+	int apply (Peaklim& p, int64_t pos, int nframes);
+
+	/* seconds, or [[hh:]mm:]ss[.fff]; returns -1 on error */
+	static double parse_time (const char* s);
+
+private:
+	Point* _pts;
+	size_t _n;
+	size_t _next;
+	float  _gain_offset;
+};
+
+#endif
@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "checksum.h"
+
+/* see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md */
+
+static const uint32_t P32_1 = 0x9E3779B1U;
+static const uint32_t P32_2 = 0x85EBCA77U;
+static const uint32_t P32_3 = 0xC2B2AE3DU;
+static const uint32_t P32_4 = 0x27D4EB2FU;
+static const uint32_t P32_5 = 0x165667B1U;
+
+static const uint64_t P64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t P64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t P64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t P64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t P64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint32_t
+rotl32 (uint32_t x, int r)
+{
+	return (x << r) | (x >> (32 - r));
+}
+
+static inline uint64_t
+rotl64 (uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint32_t
+read32 (uint8_t const* p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t
+read64 (uint8_t const* p)
+{
+	return (uint64_t)read32 (p) | ((uint64_t)read32 (p + 4) << 32);
+}
+
+static inline uint32_t
+round32 (uint32_t acc, uint32_t v)
+{
+	return rotl32 (acc + v * P32_2, 13) * P32_1;
+}
+
+static inline uint64_t
+round64 (uint64_t acc, uint64_t v)
+{
+	return rotl64 (acc + v * P64_2, 31) * P64_1;
+}
+
+static inline uint64_t
+merge64 (uint64_t acc, uint64_t v)
+{
+	return (acc ^ round64 (0, v)) * P64_1 + P64_4;
+}
+
+Checksum::Checksum (void)
+	: _algo (NONE)
+	, _total (0)
+	, _seed (0)
+	, _nbuf (0)
+{
+}
+
+Checksum::Algorithm
+Checksum::parse (const char* name)
+{
+	if (!strcasecmp (name, "xxh64") || !strcasecmp (name, "xxhash64")) {
+		return XXH64;
+	}
+	if (!strcasecmp (name, "xxh32") || !strcasecmp (name, "xxhash32")) {
+		return XXH32;
+	}
+	return NONE;
+}
+
+char const*
+Checksum::name () const
+{
+	switch (_algo) {
+		case XXH32:
+			return "xxh32";
+		case XXH64:
+			return "xxh64";
+		default:
+			break;
+	}
+	return "none";
+}
+
+void
+Checksum::init (Algorithm a, uint64_t seed)
+{
+	_algo  = a;
+	_seed  = seed;
+	_total = 0;
+	_nbuf  = 0;
+
+	if (_algo == XXH32) {
+		uint32_t s = seed;
+		_v[0]      = s + P32_1 + P32_2;
+		_v[1]      = s + P32_2;
+		_v[2]      = s;
+		_v[3]      = s - P32_1;
+	} else {
+		_v[0] = seed + P64_1 + P64_2;
+		_v[1] = seed + P64_2;
+		_v[2] = seed;
+		_v[3] = seed - P64_1;
+	}
+}
+
+void
+Checksum::consume (uint8_t const* p)
+{
+	if (_algo == XXH32) {
+		/* 16 byte stripe */
+		for (int i = 0; i < 4; ++i) {
+			_v[i] = round32 (_v[i], read32 (p + 4 * i));
+		}
+	} else {
+		/* 32 byte stripe */
+		for (int i = 0; i < 4; ++i) {
+			_v[i] = round64 (_v[i], read64 (p + 8 * i));
+		}
+	}
+}
+
+void
+Checksum::update (void const* data, size_t len)
+{
+	if (_algo == NONE) {
+		return;
+	}
+
+	uint8_t const* p      = (uint8_t const*)data;
+	size_t const   stripe = _algo == XXH32 ? 16 : 32;
+
+	_total += len;
+
+	if (_nbuf > 0) {
+		size_t n = stripe - _nbuf;
+		if (n > len) {
+			n = len;
+		}
+		memcpy (&_buf[_nbuf], p, n);
+		_nbuf += n;
+		p += n;
+		len -= n;
+		if (_nbuf < stripe) {
+			return;
+		}
+		consume (_buf);
+		_nbuf = 0;
+	}
+
+	while (len >= stripe) {
+		consume (p);
+		p += stripe;
+		len -= stripe;
+	}
+
+	if (len > 0) {
+		memcpy (_buf, p, len);
+		_nbuf = len;
+	}
+}
+
+void
+Checksum::update (float const* data, size_t n_samples)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	/* hash IEEE-754 little-endian representation */
+	for (size_t i = 0; i < n_samples; ++i) {
+		uint8_t  b[4];
+		uint32_t v;
+		memcpy (&v, &data[i], 4);
+		b[0] = v;
+		b[1] = v >> 8;
+		b[2] = v >> 16;
+		b[3] = v >> 24;
+		update (b, 4);
+	}
+#else
+	update ((void const*)data, n_samples * sizeof (float));
+#endif
+}
+
+void
+Checksum::update (int32_t const* data, size_t n_samples, int bits)
+{
+	int const w = bits / 8;
+	uint8_t   b[3 * 256];
+
+	if (_algo == NONE) {
+		return;
+	}
+	while (n_samples > 0) {
+		size_t   n = n_samples < 256 ? n_samples : 256;
+		uint8_t* p = b;
+		for (size_t i = 0; i < n; ++i) {
+			uint32_t v = data[i];
+			for (int k = 0; k < w; ++k) {
+				*p++ = v >> (8 * k);
+			}
+		}
+		update (b, n * w);
+		data += n;
+		n_samples -= n;
+	}
+}
+
+uint64_t
+Checksum::digest () const
+{
+	uint8_t const* p   = _buf;
+	uint8_t const* end = _buf + _nbuf;
+
+	if (_algo == XXH32) {
+		uint32_t h;
+		if (_total >= 16) {
+			h = rotl32 (_v[0], 1) + rotl32 (_v[1], 7) + rotl32 (_v[2], 12) + rotl32 (_v[3], 18);
+		} else {
+			h = (uint32_t)_seed + P32_5;
+		}
+		h += (uint32_t)_total;
+		for (; p + 4 <= end; p += 4) {
+			h = rotl32 (h + read32 (p) * P32_3, 17) * P32_4;
+		}
+		for (; p < end; ++p) {
+			h = rotl32 (h + (*p) * P32_5, 11) * P32_1;
+		}
+		h ^= h >> 15;
+		h *= P32_2;
+		h ^= h >> 13;
+		h *= P32_3;
+		h ^= h >> 16;
+		return h;
+	}
+
+	if (_algo != XXH64) {
+		return 0;
+	}
+
+	uint64_t h;
+	if (_total >= 32) {
+		h = rotl64 (_v[0], 1) + rotl64 (_v[1], 7) + rotl64 (_v[2], 12) + rotl64 (_v[3], 18);
+		for (int i = 0; i < 4; ++i) {
+			h = merge64 (h, _v[i]);
+		}
+	} else {
+		h = _seed + P64_5;
+	}
+	h += _total;
+	for (; p + 8 <= end; p += 8) {
+		h ^= round64 (0, read64 (p));
+		h = rotl64 (h, 27) * P64_1 + P64_4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32 (p) * P64_1;
+		h = rotl64 (h, 23) * P64_2 + P64_3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		h ^= (*p) * P64_5;
+		h = rotl64 (h, 11) * P64_1;
+	}
+	h ^= h >> 33;
+	h *= P64_2;
+	h ^= h >> 29;
+	h *= P64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+char const*
+Checksum::hex (char* buf) const
+{
+	if (_algo == XXH32) {
+		snprintf (buf, 17, "%08x", (uint32_t)digest ());
+	} else {
+		snprintf (buf, 17, "%016llx", (unsigned long long)digest ());
+	}
+	return buf;
+}
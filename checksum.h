@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHECKSUM_H
+#define _CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* incremental xxHash (XXH32, XXH64) */
+class Checksum
+{
+public:
+	enum Algorithm {
+		NONE = 0,
+		XXH32,
+		XXH64
+	};
+
+	Checksum (void);
+
+	static Algorithm parse (const char* name);
+
+	void init (Algorithm a, uint64_t seed = 0);
+	void update (void const* data, size_t len);
+	void update (float const* data, size_t n_samples);
+	/* 8, 16 or 24 bit integer samples, packed little-endian */
+	void update (int32_t const* data, size_t n_samples, int bits);
+
+	uint64_t digest () const;
+	/* hexadecimal digest, buf must hold at least 17 bytes */
+	char const* hex (char* buf) const;
+
+	Algorithm
+	algorithm () const
+	{
+		return _algo;
+	}
+
+	char const* name () const;
+
+private:
+	void consume (uint8_t const* p);
+
+	Algorithm _algo;
+	uint64_t  _total;
+	uint64_t  _seed;
+	uint64_t  _v[4];
+	uint8_t   _buf[32];
+	size_t    _nbuf;
+};
+
+#endif
@@ -0,0 +1,1266 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flacwriter.h"
+#include "trace.h"
+
+/* see https://www.rfc-editor.org/rfc/rfc9639 */
+
+/* ****************************************************************************
+ * CRC and MD5
+ */
+
+static uint8_t  crc8_tab[256];
+static uint16_t crc16_tab[256];
+
+static void
+crc_init ()
+{
+	for (int i = 0; i < 256; ++i) {
+		uint8_t  c8  = i;
+		uint16_t c16 = i << 8;
+		for (int b = 0; b < 8; ++b) {
+			c8  = (c8 & 0x80) ? (c8 << 1) ^ 0x07 : c8 << 1;
+			c16 = (c16 & 0x8000) ? (c16 << 1) ^ 0x8005 : c16 << 1;
+		}
+		crc8_tab[i]  = c8;
+		crc16_tab[i] = c16;
+	}
+}
+
+static uint8_t
+crc8 (uint8_t const* p, size_t n)
+{
+	uint8_t c = 0;
+	while (n--) {
+		c = crc8_tab[c ^ *p++];
+	}
+	return c;
+}
+
+static uint16_t
+crc16 (uint8_t const* p, size_t n)
+{
+	uint16_t c = 0;
+	while (n--) {
+		c = (c << 8) ^ crc16_tab[(c >> 8) ^ *p++];
+	}
+	return c;
+}
+
+/* RFC 1321 */
+struct FlacWriter::MD5 {
+	MD5 ()
+	{
+		_h[0] = 0x67452301;
+		_h[1] = 0xefcdab89;
+		_h[2] = 0x98badcfe;
+		_h[3] = 0x10325476;
+		_len  = 0;
+	}
+
+	void
+	update (uint8_t const* p, size_t n)
+	{
+		size_t used = _len & 63;
+		_len += n;
+		if (used) {
+			size_t k = 64 - used < n ? 64 - used : n;
+			memcpy (&_buf[used], p, k);
+			p += k;
+			n -= k;
+			if (used + k < 64) {
+				return;
+			}
+			block (_buf);
+		}
+		for (; n >= 64; n -= 64, p += 64) {
+			block (p);
+		}
+		memcpy (_buf, p, n);
+	}
+
+	void
+	digest (uint8_t* out)
+	{
+		uint64_t bits = _len * 8;
+		uint8_t  pad  = 0x80;
+		update (&pad, 1);
+		pad = 0;
+		while ((_len & 63) != 56) {
+			update (&pad, 1);
+		}
+		uint8_t l[8];
+		for (int i = 0; i < 8; ++i) {
+			l[i] = bits >> (8 * i);
+		}
+		update (l, 8);
+		for (int i = 0; i < 16; ++i) {
+			out[i] = _h[i / 4] >> (8 * (i % 4));
+		}
+	}
+
+	static uint32_t
+	rotl (uint32_t x, int c)
+	{
+		return (x << c) | (x >> (32 - c));
+	}
+
+	void
+	block (uint8_t const* p)
+	{
+		static const uint32_t K[64] = {
+			0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+			0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+			0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+			0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+			0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+			0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+			0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+			0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+		};
+		static const int R[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+		uint32_t m[16];
+		for (int i = 0; i < 16; ++i) {
+			m[i] = p[4 * i] | (p[4 * i + 1] << 8) | (p[4 * i + 2] << 16) | ((uint32_t)p[4 * i + 3] << 24);
+		}
+		uint32_t a = _h[0], b = _h[1], c = _h[2], d = _h[3];
+		for (int i = 0; i < 64; ++i) {
+			uint32_t f;
+			int      g;
+			switch (i / 16) {
+				case 0:
+					f = (b & c) | (~b & d);
+					g = i;
+					break;
+				case 1:
+					f = (d & b) | (~d & c);
+					g = (5 * i + 1) & 15;
+					break;
+				case 2:
+					f = b ^ c ^ d;
+					g = (3 * i + 5) & 15;
+					break;
+				default:
+					f = c ^ (b | ~d);
+					g = (7 * i) & 15;
+					break;
+			}
+			uint32_t t = d;
+			d          = c;
+			c          = b;
+			b          = b + rotl (a + f + K[i] + m[g], R[4 * (i / 16) + (i & 3)]);
+			a          = t;
+		}
+		_h[0] += a;
+		_h[1] += b;
+		_h[2] += c;
+		_h[3] += d;
+	}
+
+	uint32_t _h[4];
+	uint64_t _len;
+	uint8_t  _buf[64];
+};
+
+/* ****************************************************************************
+ * Bitstream
+ */
+
+class BitWriter
+{
+public:
+	BitWriter ()
+		: _buf (0)
+		, _size (0)
+		, _alloc (0)
+		, _acc (0)
+		, _nbits (0)
+		, _failed (false)
+	{
+	}
+
+	~BitWriter ()
+	{
+		free (_buf);
+	}
+
+	void
+	clear ()
+	{
+		_size   = 0;
+		_acc    = 0;
+		_nbits  = 0;
+		_failed = false;
+	}
+
+	/* append the lower n <= 32 bits of v */
+	void
+	put (uint32_t v, int n)
+	{
+		if (n == 0) {
+			return;
+		}
+		_acc = (_acc << n) | (v & (0xffffffffu >> (32 - n)));
+		_nbits += n;
+		while (_nbits >= 8) {
+			_nbits -= 8;
+			byte (_acc >> _nbits);
+		}
+	}
+
+	void
+	put_signed (int32_t v, int n)
+	{
+		put ((uint32_t)v, n);
+	}
+
+	void
+	put_zeros (uint32_t n)
+	{
+		for (; n >= 32; n -= 32) {
+			put (0, 32);
+		}
+		put (0, n);
+	}
+
+	void
+	put_rice (uint32_t u, int k)
+	{
+		put_zeros (u >> k);
+		put ((1u << k) | (u & ((1u << k) - 1)), k + 1);
+	}
+
+	void
+	align ()
+	{
+		if (_nbits) {
+			put (0, 8 - _nbits);
+		}
+	}
+
+	/* byte aligned */
+	uint8_t const* data () const { return _buf; }
+	size_t         size () const { return _size; }
+
+	/* out of memory, data is incomplete */
+	bool failed () const { return _failed; }
+
+private:
+	void
+	byte (uint8_t b)
+	{
+		if (_size == _alloc) {
+			size_t   alloc = _alloc ? 2 * _alloc : 16384;
+			uint8_t* buf   = (uint8_t*)realloc (_buf, alloc);
+			if (!buf) {
+				_failed = true;
+				return;
+			}
+			_buf   = buf;
+			_alloc = alloc;
+		}
+		_buf[_size++] = b;
+	}
+
+	uint8_t* _buf;
+	size_t   _size;
+	size_t   _alloc;
+	uint64_t _acc;
+	int      _nbits;
+	bool     _failed;
+};
+
+/* ****************************************************************************
+ * Subframe analysis
+ */
+
+struct Level {
+	bool stereo;    /* try mid/side, left/side, right/side */
+	int  lpc_order; /* 0: fixed predictors only */
+	int  max_porder;
+};
+
+static const Level levels[9] = {
+	{ false, 0, 3 },
+	{ true, 0, 3 },
+	{ true, 0, 3 },
+	{ false, 6, 4 },
+	{ true, 8, 4 },
+	{ true, 8, 5 },
+	{ true, 8, 6 },
+	{ true, 12, 6 },
+	{ true, 12, 6 }
+};
+
+enum {
+	QLP_PRECISION = 12,
+	MAX_PORDER    = 8
+};
+
+/* encoding of one channel of a frame */
+struct Plan {
+	enum { CONSTANT, VERBATIM, FIXED, LPC } type;
+
+	int      bps;
+	int      order;
+	int      shift;
+	int32_t  qlp[FlacWriter::MAX_ORDER];
+	int      porder;
+	int      method; /* 0: 4-bit, 1: 5-bit rice parameters */
+	int      param[1 << MAX_PORDER];
+	uint64_t bits;
+};
+
+struct FlacWriter::Job {
+	enum { FREE, TODO, BUSY, DONE } state;
+
+	uint64_t  number;
+	int       nframes;
+	int32_t*  smp; /* planar, nchan * BLOCKSIZE */
+	BitWriter bw;
+
+	/* scratch, used by the encoding thread */
+	int32_t*  side;    /* mid and side, 2 * BLOCKSIZE */
+	uint32_t* res;     /* residual per candidate channel, 4 * BLOCKSIZE */
+	uint32_t* tmp;     /* residual of the LPC trial */
+	double*   win;     /* windowed signal */
+	double*   tukey;   /* LPC window of tukey_n samples */
+	int       tukey_n;
+};
+
+static inline uint32_t
+zigzag (int64_t e)
+{
+	return ((uint32_t)e << 1) ^ (uint32_t)(e >> 63);
+}
+
+/* choose partition order and rice parameters for residual `u`,
+ * returns the estimated size in bits */
+static uint64_t
+rice_plan (uint32_t const* u, int n, int order, int max_porder, Plan* pl)
+{
+	/* the partition order is limited by the block-size and predictor order */
+	int pmax = 0;
+	while (pmax < max_porder && pmax < MAX_PORDER && (n % (2 << pmax)) == 0 && (n >> (pmax + 1)) > order) {
+		++pmax;
+	}
+
+	uint64_t sums[2 << MAX_PORDER];
+	uint64_t* s = &sums[1 << MAX_PORDER]; /* level pmax, then merged downwards */
+	{
+		int np  = 1 << pmax;
+		int len = n >> pmax;
+		int i   = order;
+		for (int p = 0; p < np; ++p) {
+			uint64_t sum = 0;
+			int      end = (p + 1) * len;
+			for (; i < end; ++i) {
+				sum += u[i];
+			}
+			s[p] = sum;
+		}
+	}
+
+	uint64_t best = UINT64_MAX;
+	for (int po = pmax; po >= 0; --po) {
+		int      np   = 1 << po;
+		int      len  = n >> po;
+		uint64_t bits = 0;
+		int      par[1 << MAX_PORDER];
+		bool     wide = false;
+		for (int p = 0; p < np; ++p) {
+			int      cnt = p == 0 ? len - order : len;
+			uint64_t sum = s[p];
+			int      k   = 0;
+			while (k < 30 && ((uint64_t)cnt << (k + 1)) < sum) {
+				++k;
+			}
+			par[p] = k;
+			wide |= k > 14;
+			bits += (uint64_t)cnt * (k + 1) + (sum >> k);
+		}
+		bits += np * (wide ? 5 : 4);
+		if (bits < best) {
+			best       = bits;
+			pl->porder = po;
+			pl->method = wide ? 1 : 0;
+			memcpy (pl->param, par, np * sizeof (int));
+		}
+		/* merge pairs for the next lower order */
+		for (int p = 0; p < np / 2; ++p) {
+			s[p] = s[2 * p] + s[2 * p + 1];
+		}
+	}
+	return best + 6; /* method and partition order */
+}
+
+static void
+fixed_residual (int32_t const* x, int n, int order, uint32_t* u)
+{
+	for (int i = order; i < n; ++i) {
+		int64_t e;
+		switch (order) {
+			case 0:
+				e = x[i];
+				break;
+			case 1:
+				e = (int64_t)x[i] - x[i - 1];
+				break;
+			case 2:
+				e = (int64_t)x[i] - 2 * (int64_t)x[i - 1] + x[i - 2];
+				break;
+			case 3:
+				e = (int64_t)x[i] - 3 * (int64_t)x[i - 1] + 3 * (int64_t)x[i - 2] - x[i - 3];
+				break;
+			default:
+				e = (int64_t)x[i] - 4 * (int64_t)x[i - 1] + 6 * (int64_t)x[i - 2] - 4 * (int64_t)x[i - 3] + x[i - 4];
+				break;
+		}
+		u[i] = zigzag (e);
+	}
+}
+
+/* best fixed predictor, by the sum of absolute residuals */
+static int
+fixed_order (int32_t const* x, int n)
+{
+	if (n < 5) {
+		return 0;
+	}
+	uint64_t sum[5] = { 0, 0, 0, 0, 0 };
+	int64_t  x1 = x[3], x2 = x[2], x3 = x[1], x4 = x[0];
+	for (int i = 4; i < n; ++i) {
+		int64_t v = x[i];
+		int64_t d1 = v - x1;
+		int64_t d2 = d1 - (x1 - x2);
+		int64_t d3 = d2 - (x1 - 2 * x2 + x3);
+		int64_t d4 = d3 - (x1 - 3 * x2 + 3 * x3 - x4);
+		sum[0] += v < 0 ? -v : v;
+		sum[1] += d1 < 0 ? -d1 : d1;
+		sum[2] += d2 < 0 ? -d2 : d2;
+		sum[3] += d3 < 0 ? -d3 : d3;
+		sum[4] += d4 < 0 ? -d4 : d4;
+		x4 = x3;
+		x3 = x2;
+		x2 = x1;
+		x1 = v;
+	}
+	int o = 0;
+	for (int i = 1; i < 5; ++i) {
+		if (sum[i] < sum[o]) {
+			o = i;
+		}
+	}
+	return o;
+}
+
+/* Autocorrelation of the windowed signal. The inner loops are
+ * reductions over contiguous data, which GCC vectorizes with
+ * -O3 -ffast-math.
+ */
+static void
+autocorr (double const* w, int n, int maxlag, double* ac)
+{
+	for (int l = 0; l <= maxlag; ++l) {
+		double sum = 0;
+		for (int i = l; i < n; ++i) {
+			sum += w[i] * w[i - l];
+		}
+		ac[l] = sum;
+	}
+}
+
+/* Levinson-Durbin recursion, lp[o-1][..] are the coefficients of order o,
+ * err[o-1] its prediction error. Returns the highest usable order.
+ */
+static int
+levinson (double const* ac, int maxorder, double lp[][FlacWriter::MAX_ORDER], double* err)
+{
+	double a[FlacWriter::MAX_ORDER];
+	double e = ac[0];
+	for (int o = 0; o < maxorder; ++o) {
+		if (e <= 0) {
+			return o;
+		}
+		double r = -ac[o + 1];
+		for (int j = 0; j < o; ++j) {
+			r -= a[j] * ac[o - j];
+		}
+		r /= e;
+		a[o] = r;
+		for (int j = 0; j < o / 2; ++j) {
+			double t     = a[j];
+			a[j]         = t + r * a[o - 1 - j];
+			a[o - 1 - j] = a[o - 1 - j] + r * t;
+		}
+		if (o & 1) {
+			a[o / 2] += a[o / 2] * r;
+		}
+		e *= 1.0 - r * r;
+		for (int j = 0; j <= o; ++j) {
+			lp[o][j] = -a[j];
+		}
+		err[o] = e;
+	}
+	return maxorder;
+}
+
+/* quantize coefficients with error feedback, false if not representable */
+static bool
+quantize (double const* lp, int order, int precision, int32_t* q, int* shift)
+{
+	double cmax = 0;
+	for (int i = 0; i < order; ++i) {
+		cmax = fmax (cmax, fabs (lp[i]));
+	}
+	if (cmax <= 0) {
+		return false;
+	}
+	int log2cmax;
+	frexp (cmax, &log2cmax);
+	int s = precision - 1 - log2cmax;
+	if (s > 15) {
+		s = 15;
+	}
+	if (s < 0) {
+		return false;
+	}
+	int32_t qmax = (1 << (precision - 1)) - 1;
+	int32_t qmin = -(1 << (precision - 1));
+	double  err  = 0;
+	for (int i = 0; i < order; ++i) {
+		err += lp[i] * (1 << s);
+		int32_t v = lround (err);
+		v         = v > qmax ? qmax : v < qmin ? qmin : v;
+		err -= v;
+		q[i] = v;
+	}
+	*shift = s;
+	return true;
+}
+
+static bool
+lpc_residual (int32_t const* x, int n, int32_t const* q, int order, int shift, uint32_t* u)
+{
+	for (int i = order; i < n; ++i) {
+		int64_t sum = 0;
+		for (int j = 0; j < order; ++j) {
+			sum += (int64_t)q[j] * x[i - j - 1];
+		}
+		int64_t e = x[i] - (sum >> shift);
+		if (e > INT32_MAX || e < INT32_MIN) {
+			return false;
+		}
+		u[i] = zigzag (e);
+	}
+	return true;
+}
+
+static void
+analyze (int32_t const* x, int n, int bps, Level const& lv, FlacWriter::Job* job, uint32_t* res, Plan* pl)
+{
+	pl->bps = bps;
+
+	bool constant = true;
+	for (int i = 1; i < n && constant; ++i) {
+		constant = x[i] == x[0];
+	}
+	if (constant) {
+		pl->type = Plan::CONSTANT;
+		pl->bits = bps;
+		return;
+	}
+
+	pl->type = Plan::VERBATIM;
+	pl->bits = (uint64_t)n * bps;
+
+	int order = fixed_order (x, n);
+	fixed_residual (x, n, order, res);
+	Plan     fx   = *pl;
+	uint64_t bits = rice_plan (res, n, order, lv.max_porder, &fx) + order * bps;
+	if (bits < pl->bits) {
+		*pl       = fx;
+		pl->type  = Plan::FIXED;
+		pl->order = order;
+		pl->bits  = bits;
+	}
+
+	int maxorder = lv.lpc_order < n - 1 ? lv.lpc_order : n - 1;
+	if (maxorder < 1) {
+		return;
+	}
+
+	/* Tukey (0.5) window, only the last block is shorter */
+	if (job->tukey_n != n) {
+		int nt = n / 4;
+		for (int i = 0; i < n; ++i) {
+			double g = 1.0;
+			if (i < nt) {
+				g = 0.5 - 0.5 * cos (M_PI * i / nt);
+			} else if (i >= n - nt) {
+				g = 0.5 - 0.5 * cos (M_PI * (n - 1 - i) / nt);
+			}
+			job->tukey[i] = g;
+		}
+		job->tukey_n = n;
+	}
+	double* w = job->win;
+	for (int i = 0; i < n; ++i) {
+		w[i] = job->tukey[i] * x[i];
+	}
+
+	double ac[FlacWriter::MAX_ORDER + 1];
+	double lp[FlacWriter::MAX_ORDER][FlacWriter::MAX_ORDER];
+	double err[FlacWriter::MAX_ORDER];
+	autocorr (w, n, maxorder, ac);
+	maxorder = levinson (ac, maxorder, lp, err);
+
+	/* pick the order with the least expected size */
+	int    best = 0;
+	double est  = 0;
+	for (int o = 1; o <= maxorder; ++o) {
+		double bpr = err[o - 1] > 0 ? 0.5 * log2 (0.5 * M_LN2 * M_LN2 * err[o - 1] / n) : 0;
+		double b   = (n - o) * (bpr > 0 ? bpr : 0) + o * (bps + QLP_PRECISION);
+		if (best == 0 || b < est) {
+			best = o;
+			est  = b;
+		}
+	}
+	if (best == 0) {
+		return;
+	}
+
+	Plan lpc = *pl;
+	if (!quantize (lp[best - 1], best, QLP_PRECISION, lpc.qlp, &lpc.shift)) {
+		return;
+	}
+	if (!lpc_residual (x, n, lpc.qlp, best, lpc.shift, job->tmp)) {
+		return;
+	}
+	bits = rice_plan (job->tmp, n, best, lv.max_porder, &lpc) + best * (bps + QLP_PRECISION) + 4 + 5;
+	if (bits < pl->bits) {
+		*pl       = lpc;
+		pl->type  = Plan::LPC;
+		pl->order = best;
+		pl->bits  = bits;
+		memcpy (&res[best], &job->tmp[best], (n - best) * sizeof (uint32_t));
+	}
+}
+
+static void
+write_subframe (BitWriter& bw, int32_t const* x, int n, uint32_t const* res, Plan const& pl)
+{
+	switch (pl.type) {
+		case Plan::CONSTANT:
+			bw.put (0x00, 8);
+			bw.put_signed (x[0], pl.bps);
+			return;
+		case Plan::VERBATIM:
+			bw.put (0x02, 8);
+			for (int i = 0; i < n; ++i) {
+				bw.put_signed (x[i], pl.bps);
+			}
+			return;
+		case Plan::FIXED:
+			bw.put ((0x08 | pl.order) << 1, 8);
+			break;
+		case Plan::LPC:
+			bw.put ((0x20 | (pl.order - 1)) << 1, 8);
+			break;
+	}
+
+	for (int i = 0; i < pl.order; ++i) {
+		bw.put_signed (x[i], pl.bps);
+	}
+	if (pl.type == Plan::LPC) {
+		bw.put (QLP_PRECISION - 1, 4);
+		bw.put_signed (pl.shift, 5);
+		for (int i = 0; i < pl.order; ++i) {
+			bw.put_signed (pl.qlp[i], QLP_PRECISION);
+		}
+	}
+
+	bw.put (pl.method, 2);
+	bw.put (pl.porder, 4);
+	int np  = 1 << pl.porder;
+	int len = n >> pl.porder;
+	int i   = pl.order;
+	for (int p = 0; p < np; ++p) {
+		int k = pl.param[p];
+		bw.put (k, pl.method ? 5 : 4);
+		for (int end = (p + 1) * len; i < end; ++i) {
+			bw.put_rice (res[i], k);
+		}
+	}
+}
+
+static void
+put_utf8 (BitWriter& bw, uint64_t v)
+{
+	if (v < 0x80) {
+		bw.put (v, 8);
+		return;
+	}
+	int nb = v < 0x800 ? 2 : v < 0x10000 ? 3 : v < 0x200000 ? 4 : v < 0x4000000 ? 5 : 6;
+	bw.put ((0xff00 >> nb) | (v >> (6 * (nb - 1))), 8);
+	for (int i = nb - 2; i >= 0; --i) {
+		bw.put (0x80 | ((v >> (6 * i)) & 0x3f), 8);
+	}
+}
+
+static int
+rate_code (int rate, int* extra, int* extra_bits)
+{
+	static const int rates[] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+	for (int i = 1; i < 12; ++i) {
+		if (rates[i] == rate) {
+			*extra_bits = 0;
+			return i;
+		}
+	}
+	if (rate % 1000 == 0 && rate / 1000 < 256) {
+		*extra      = rate / 1000;
+		*extra_bits = 8;
+		return 12;
+	}
+	if (rate < 65536) {
+		*extra      = rate;
+		*extra_bits = 16;
+		return 13;
+	}
+	if (rate % 10 == 0 && rate / 10 < 65536) {
+		*extra      = rate / 10;
+		*extra_bits = 16;
+		return 14;
+	}
+	*extra_bits = 0;
+	return 0;
+}
+
+static void
+encode_frame (FlacWriter::Job* job, int rate, int nchan, int bits, Level const& lv)
+{
+	BitWriter& bw = job->bw;
+	int const  n  = job->nframes;
+	int const  bs = FlacWriter::BLOCKSIZE;
+
+	bw.clear ();
+
+	/* stereo decorrelation, analyze L, R, mid and side */
+	Plan pl[4];
+	int  chn_assign = nchan - 1;
+
+	int32_t const* l    = job->smp;
+	int32_t const* r    = &job->smp[bs];
+	int32_t*       mid  = job->side;
+	int32_t*       side = &job->side[bs];
+
+	if (lv.stereo && nchan == 2) {
+		for (int i = 0; i < n; ++i) {
+			mid[i]  = ((int64_t)l[i] + r[i]) >> 1;
+			side[i] = l[i] - r[i];
+		}
+		analyze (l, n, bits, lv, job, &job->res[0], &pl[0]);
+		analyze (r, n, bits, lv, job, &job->res[bs], &pl[1]);
+		analyze (mid, n, bits, lv, job, &job->res[2 * bs], &pl[2]);
+		analyze (side, n, bits + 1, lv, job, &job->res[3 * bs], &pl[3]);
+
+		uint64_t lr = pl[0].bits + pl[1].bits;
+		uint64_t ls = pl[0].bits + pl[3].bits;
+		uint64_t rs = pl[1].bits + pl[3].bits;
+		uint64_t ms = pl[2].bits + pl[3].bits;
+		if (ls < lr && ls <= rs && ls <= ms) {
+			chn_assign = 8;
+		} else if (rs < lr && rs <= ms) {
+			chn_assign = 9;
+		} else if (ms < lr) {
+			chn_assign = 10;
+		}
+	}
+
+	/* header */
+	int bs_code = n == bs ? 12 : 7;
+	int rate_extra, rate_bits;
+	int rcode     = rate_code (rate, &rate_extra, &rate_bits);
+	int size_code = bits == 8 ? 1 : bits == 12 ? 2 : bits == 16 ? 4 : bits == 20 ? 5 : bits == 24 ? 6 : 0;
+
+	bw.put (0xfff8, 16);
+	bw.put (bs_code, 4);
+	bw.put (rcode, 4);
+	bw.put (chn_assign, 4);
+	bw.put (size_code, 3);
+	bw.put (0, 1);
+	put_utf8 (bw, job->number);
+	if (bs_code == 7) {
+		bw.put (n - 1, 16);
+	}
+	bw.put (rate_extra, rate_bits);
+	bw.put (crc8 (bw.data (), bw.size ()), 8);
+
+	switch (chn_assign) {
+		case 1:
+			if (lv.stereo) {
+				write_subframe (bw, l, n, &job->res[0], pl[0]);
+				write_subframe (bw, r, n, &job->res[bs], pl[1]);
+				break;
+			}
+			/* fallthrough */
+		default:
+			for (int c = 0; c < nchan; ++c) {
+				int32_t const* x = &job->smp[c * bs];
+				analyze (x, n, bits, lv, job, job->res, &pl[0]);
+				write_subframe (bw, x, n, job->res, pl[0]);
+			}
+			break;
+		case 8:
+			write_subframe (bw, l, n, &job->res[0], pl[0]);
+			write_subframe (bw, side, n, &job->res[3 * bs], pl[3]);
+			break;
+		case 9:
+			write_subframe (bw, side, n, &job->res[3 * bs], pl[3]);
+			write_subframe (bw, r, n, &job->res[bs], pl[1]);
+			break;
+		case 10:
+			write_subframe (bw, mid, n, &job->res[2 * bs], pl[2]);
+			write_subframe (bw, side, n, &job->res[3 * bs], pl[3]);
+			break;
+	}
+
+	bw.align ();
+	uint16_t crc = crc16 (bw.data (), bw.size ());
+	bw.put (crc, 16);
+}
+
+/* ****************************************************************************
+ * FlacWriter
+ */
+
+FlacWriter::FlacWriter (void)
+	: _f (0)
+	, _tags (0)
+	, _tags_len (0)
+	, _ntags (0)
+	, _md5 (0)
+	, _jobs (0)
+	, _njobs (0)
+	, _threads (0)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once (&once, crc_init);
+}
+
+FlacWriter::~FlacWriter (void)
+{
+	close ();
+}
+
+bool
+FlacWriter::open (const char* path, int rate, int nchan, int bits, int level, int nthreads)
+{
+	close ();
+
+	if (rate <= 0 || rate >= (1 << 20) || nchan < 1 || nchan > MAX_CHANNELS || (bits != 8 && bits != 16 && bits != 24) || level < 0 || level > 8 || nthreads > 64) {
+		return false;
+	}
+
+	_rate     = rate;
+	_nchan    = nchan;
+	_bits     = bits;
+	_level    = level;
+	_nthreads = nthreads > 1 ? nthreads : 0;
+	_header   = false;
+	_error    = false;
+	_frames   = 0;
+	_blocks   = 0;
+	_min_size = UINT32_MAX;
+	_max_size = 0;
+	_md5      = new MD5 ();
+	_stop     = false;
+	_cur      = 0;
+	_njobs    = _nthreads > 0 ? 2 * _nthreads : 1;
+	_jobs     = new Job[_njobs];
+
+	bool ok = true;
+	for (int i = 0; i < _njobs; ++i) {
+		Job* j     = &_jobs[i];
+		j->state   = Job::FREE;
+		j->nframes = 0;
+		j->smp     = (int32_t*)malloc (nchan * BLOCKSIZE * sizeof (int32_t));
+		j->side    = (int32_t*)malloc (2 * BLOCKSIZE * sizeof (int32_t));
+		j->res     = (uint32_t*)malloc (4 * BLOCKSIZE * sizeof (uint32_t));
+		j->tmp     = (uint32_t*)malloc (BLOCKSIZE * sizeof (uint32_t));
+		j->win     = (double*)malloc (BLOCKSIZE * sizeof (double));
+		j->tukey   = (double*)malloc (BLOCKSIZE * sizeof (double));
+		j->tukey_n = 0;
+		ok &= j->smp && j->side && j->res && j->tmp && j->win && j->tukey;
+	}
+
+	if (ok) {
+		_f = fopen (path, "wb");
+	}
+	if (!_f) {
+		free_jobs ();
+		return false;
+	}
+
+	if (_nthreads > 0) {
+		_threads = (pthread_t*)calloc (_nthreads, sizeof (pthread_t));
+		if (!_threads) {
+			_nthreads = 0;
+		}
+	}
+
+	if (_nthreads > 0) {
+		pthread_mutex_init (&_lock, 0);
+		pthread_cond_init (&_cond, 0);
+		for (int i = 0; i < _nthreads; ++i) {
+			if (pthread_create (&_threads[i], 0, run, this)) {
+				_nthreads = i;
+				break;
+			}
+		}
+		if (_nthreads == 0) {
+			/* encode on the calling thread */
+			free (_threads);
+			_threads = 0;
+			pthread_mutex_destroy (&_lock);
+			pthread_cond_destroy (&_cond);
+		}
+	}
+	return true;
+}
+
+bool
+FlacWriter::add_tag (const char* key, const char* value)
+{
+	if (!key || !value || _header) {
+		return true;
+	}
+	size_t len  = strlen (key) + 1 + strlen (value);
+	char*  tags = (char*)realloc (_tags, _tags_len + 4 + len);
+	if (!tags) {
+		_error = true;
+		return false;
+	}
+	_tags   = tags;
+	char* p = &_tags[_tags_len];
+	for (int i = 0; i < 4; ++i) {
+		p[i] = (len >> (8 * i)) & 0xff;
+	}
+	memcpy (&p[4], key, strlen (key));
+	p[4 + strlen (key)] = '=';
+	memcpy (&p[5 + strlen (key)], value, strlen (value));
+	_tags_len += 4 + len;
+	++_ntags;
+	return true;
+}
+
+int
+FlacWriter::write (float const* buf, int nframes)
+{
+	if (!_f || _error) {
+		return 0;
+	}
+
+	int done = 0;
+	while (done < nframes) {
+		Job* j = &_jobs[_cur];
+		int  n = BLOCKSIZE - j->nframes;
+		if (n > nframes - done) {
+			n = nframes - done;
+		}
+		for (int c = 0; c < _nchan; ++c) {
+			int32_t*     d = &j->smp[c * BLOCKSIZE + j->nframes];
+			float const* s = &buf[done * _nchan + c];
+			for (int i = 0; i < n; ++i) {
+				d[i] = quantize (s[i * _nchan], _bits);
+			}
+		}
+		j->nframes += n;
+		done += n;
+		if (j->nframes == BLOCKSIZE) {
+			submit ();
+			if (_error) {
+				break;
+			}
+		}
+	}
+	return done;
+}
+
+bool
+FlacWriter::close ()
+{
+	if (!_f) {
+		return true;
+	}
+
+	if (_jobs[_cur].nframes > 0) {
+		submit ();
+	}
+
+	/* collect remaining frames, oldest first */
+	for (int i = 0; i < _njobs; ++i) {
+		flush_job (&_jobs[(_cur + i) % _njobs]);
+	}
+
+	if (_threads) {
+		pthread_mutex_lock (&_lock);
+		_stop = true;
+		pthread_cond_broadcast (&_cond);
+		pthread_mutex_unlock (&_lock);
+		for (int i = 0; i < _nthreads; ++i) {
+			pthread_join (_threads[i], 0);
+		}
+		free (_threads);
+		pthread_mutex_destroy (&_lock);
+		pthread_cond_destroy (&_cond);
+		_threads = 0;
+	}
+
+	/* update STREAMINFO */
+	if (!_header && !write_header ()) {
+		_error = true;
+	}
+	if (fseek (_f, 4, SEEK_SET) || !write_header ()) {
+		_error = true;
+	}
+
+	bool rv = !_error;
+	if (fclose (_f)) {
+		rv = false;
+	}
+
+	_f = 0;
+	free_jobs ();
+	return rv;
+}
+
+void
+FlacWriter::free_jobs ()
+{
+	for (int i = 0; i < _njobs; ++i) {
+		free (_jobs[i].smp);
+		free (_jobs[i].side);
+		free (_jobs[i].res);
+		free (_jobs[i].tmp);
+		free (_jobs[i].win);
+		free (_jobs[i].tukey);
+	}
+	delete[] _jobs;
+	delete _md5;
+	free (_tags);
+
+	_jobs     = 0;
+	_md5      = 0;
+	_tags     = 0;
+	_tags_len = 0;
+	_ntags    = 0;
+}
+
+void*
+FlacWriter::run (void* arg)
+{
+	((FlacWriter*)arg)->worker ();
+	return 0;
+}
+
+void
+FlacWriter::worker ()
+{
+	Trace::thread_name ("flac-encode");
+
+	pthread_mutex_lock (&_lock);
+	while (true) {
+		Job* j = 0;
+		for (int i = 0; i < _njobs; ++i) {
+			Job* k = &_jobs[i];
+			if (k->state == Job::TODO && (!j || k->number < j->number)) {
+				j = k;
+			}
+		}
+		if (!j) {
+			if (_stop) {
+				break;
+			}
+			pthread_cond_wait (&_cond, &_lock);
+			continue;
+		}
+		j->state = Job::BUSY;
+		pthread_mutex_unlock (&_lock);
+
+		{
+			TraceSpan span ("encode", j->number);
+			encode_frame (j, _rate, _nchan, _bits, levels[_level]);
+		}
+
+		pthread_mutex_lock (&_lock);
+		j->state = Job::DONE;
+		pthread_cond_broadcast (&_cond);
+	}
+	pthread_mutex_unlock (&_lock);
+}
+
+/* queue the current job, and make the next one available */
+void
+FlacWriter::submit ()
+{
+	Job* j = &_jobs[_cur];
+
+	/* MD5 of the interleaved little-endian samples, in order */
+	uint8_t tmp[1024];
+	int     bps = _bits / 8;
+	size_t  len = 0;
+	for (int i = 0; i < j->nframes; ++i) {
+		for (int c = 0; c < _nchan; ++c) {
+			int32_t v = j->smp[c * BLOCKSIZE + i];
+			for (int b = 0; b < bps; ++b) {
+				tmp[len++] = v >> (8 * b);
+			}
+		}
+		if (len > sizeof (tmp) - 8 * 3) {
+			_md5->update (tmp, len);
+			len = 0;
+		}
+	}
+	_md5->update (tmp, len);
+
+	_frames += j->nframes;
+	j->number = _blocks++;
+
+	if (!_threads) {
+		{
+			TraceSpan span ("encode", j->number);
+			encode_frame (j, _rate, _nchan, _bits, levels[_level]);
+		}
+		j->state = Job::DONE;
+		flush_job (j);
+		return;
+	}
+
+	pthread_mutex_lock (&_lock);
+	j->state = Job::TODO;
+	pthread_cond_broadcast (&_cond);
+	pthread_mutex_unlock (&_lock);
+
+	_cur = (_cur + 1) % _njobs;
+	flush_job (&_jobs[_cur]);
+}
+
+/* wait for the job to complete, and write it */
+bool
+FlacWriter::flush_job (Job* j)
+{
+	if (_threads) {
+		TraceSpan span ("wait-encode", j->number);
+		pthread_mutex_lock (&_lock);
+		while (j->state == Job::TODO || j->state == Job::BUSY) {
+			pthread_cond_wait (&_cond, &_lock);
+		}
+		pthread_mutex_unlock (&_lock);
+	}
+
+	if (j->state == Job::DONE) {
+		TraceSpan span ("flac-write", j->number);
+		uint32_t size = j->bw.size ();
+		if (j->bw.failed ()) {
+			_error = true;
+		}
+		if (!_header && !write_header ()) {
+			_error = true;
+		}
+		if (!_error && fwrite (j->bw.data (), 1, size, _f) != size) {
+			_error = true;
+		}
+		_min_size = size < _min_size ? size : _min_size;
+		_max_size = size > _max_size ? size : _max_size;
+	}
+
+	if (_threads) {
+		pthread_mutex_lock (&_lock);
+	}
+	j->state   = Job::FREE;
+	j->nframes = 0;
+	if (_threads) {
+		pthread_mutex_unlock (&_lock);
+	}
+	return !_error;
+}
+
+/* write the stream header, or when called again update STREAMINFO in place */
+bool
+FlacWriter::write_header ()
+{
+	BitWriter bw;
+	bool      update = _header;
+
+	if (!update) {
+		bw.put ('f', 8);
+		bw.put ('L', 8);
+		bw.put ('a', 8);
+		bw.put ('C', 8);
+	}
+
+	uint8_t digest[16];
+	MD5     md5 (*_md5);
+	md5.digest (digest);
+
+	/* STREAMINFO */
+	bw.put (_ntags > 0 ? 0x00 : 0x80, 8);
+	bw.put (34, 24);
+	bw.put (BLOCKSIZE, 16);
+	bw.put (BLOCKSIZE, 16);
+	bw.put (_max_size > 0 ? _min_size : 0, 24);
+	bw.put (_max_size, 24);
+	bw.put (_rate, 20);
+	bw.put (_nchan - 1, 3);
+	bw.put (_bits - 1, 5);
+	bw.put (_frames >> 32, 4);
+	bw.put (_frames & 0xffffffff, 32);
+	for (int i = 0; i < 16; ++i) {
+		bw.put (digest[i], 8);
+	}
+
+	if (!update && _ntags > 0) {
+		/* VORBIS_COMMENT, little-endian lengths */
+		static const char vendor[] = "sound-gambit";
+		uint32_t          vlen     = strlen (vendor);
+		bw.put (0x84, 8);
+		bw.put (4 + vlen + 4 + _tags_len, 24);
+		for (int i = 0; i < 4; ++i) {
+			bw.put ((vlen >> (8 * i)) & 0xff, 8);
+		}
+		for (uint32_t i = 0; i < vlen; ++i) {
+			bw.put (vendor[i], 8);
+		}
+		for (int i = 0; i < 4; ++i) {
+			bw.put ((_ntags >> (8 * i)) & 0xff, 8);
+		}
+		for (size_t i = 0; i < _tags_len; ++i) {
+			bw.put ((uint8_t)_tags[i], 8);
+		}
+	}
+
+	_header = true;
+	return !bw.failed () && fwrite (bw.data (), 1, bw.size (), _f) == bw.size ();
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FLACWRITER_H
+#define _FLACWRITER_H
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* FLAC encoder, compressing frames in parallel.
+ *
+ * Each block of BLOCKSIZE frames is encoded independently by a pool of
+ * worker threads, and written in order by the calling thread. Memory
+ * is bounded by two blocks per thread. The stream has a STREAMINFO
+ * with MD5 signature, and an optional VORBIS_COMMENT block.
+ *
+ * Compression levels 0..8 follow the reference encoder: 0-2 use fixed
+ * predictors, 3-8 LPC of increasing order, and all but 0 and 3 try
+ * stereo decorrelation.
+ */
+class FlacWriter
+{
+public:
+	enum {
+		BLOCKSIZE    = 4096,
+		MAX_ORDER    = 12,
+		MAX_CHANNELS = 8
+	};
+
+	FlacWriter (void);
+	~FlacWriter (void);
+
+	/* up to MAX_CHANNELS, bits per sample 8..24, a level of 0..8, and up to 64 threads */
+	bool open (const char* path, int rate, int nchan, int bits, int level, int nthreads);
+
+	/* add a vorbis comment, before the first write (),
+	 * false if out of memory */
+	bool add_tag (const char* key, const char* value);
+
+	/* like sf_writef_float (), interleaved, clipped to [-1, 1] */
+	int write (float const* buf, int nframes);
+
+	/* the sample conversion of write () */
+	static int32_t
+	quantize (float x, int bits)
+	{
+		int32_t vmax = (1 << (bits - 1)) - 1;
+		int32_t v    = lrintf (x * vmax);
+		return v > vmax ? vmax : v < -vmax - 1 ? -vmax - 1 : v;
+	}
+
+	/* encode remaining data and update STREAMINFO, false on error */
+	bool close ();
+
+	struct Job;
+	struct MD5;
+
+private:
+	static void* run (void*);
+
+	void worker ();
+	void submit ();
+	bool flush_job (Job*);
+	bool write_header ();
+	void free_jobs ();
+
+	FILE*    _f;
+	int      _rate;
+	int      _nchan;
+	int      _bits;
+	int      _level;
+	int      _nthreads;
+	bool     _header;
+	bool     _error;
+	char*    _tags;
+	size_t   _tags_len;
+	uint32_t _ntags;
+
+	uint64_t _frames;   /* samples per channel */
+	uint64_t _blocks;   /* frames submitted */
+	uint32_t _min_size; /* encoded frame size */
+	uint32_t _max_size;
+	MD5*     _md5;
+
+	Job*       _jobs;
+	int        _njobs;
+	int        _cur; /* job being filled */
+	pthread_t* _threads;
+
+	pthread_mutex_t _lock;
+	pthread_cond_t  _cond;
+	bool            _stop;
+};
+
+#endif
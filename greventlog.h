@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GREVENTLOG_H
+#define _GREVENTLOG_H
+
+#include <stdint.h>
+
+/* Gain-reduction events, detected once per chunk.
+ *
+ * An event starts with the first chunk whose required gain is below
+ * the threshold, and ends with the first chunk above it. Completed
+ * events are queued in a fixed-size ring, which is to be emptied using
+ * pop() at least every SIZE chunks; events that do not fit are counted
+ * as dropped. Recording is constant time and does not allocate.
+ */
+class GrEventLog
+{
+public:
+	enum {
+		SIZE = 256,
+		MASK = SIZE - 1
+	};
+
+	struct Event {
+		int64_t start;  /* first frame */
+		int64_t length; /* frames */
+		float   gain;   /* lowest required gain, coefficient */
+	};
+
+	GrEventLog (float threshold)
+		: _threshold (threshold)
+	{
+		reset ();
+	}
+
+	void
+	reset ()
+	{
+		_frames  = 0;
+		_active  = false;
+		_rd      = 0;
+		_wr      = 0;
+		_dropped = 0;
+	}
+
+	/* called at the end of each chunk, with its gain */
+	void
+	chunk (int len, float g)
+	{
+		if (g < _threshold) {
+			if (!_active) {
+				_active    = true;
+				_cur.start = _frames;
+				_cur.gain  = g;
+			} else if (g < _cur.gain) {
+				_cur.gain = g;
+			}
+		} else if (_active) {
+			end ();
+		}
+		_frames += len;
+	}
+
+	/* close an active event, e.g. at the end of the input */
+	void
+	flush ()
+	{
+		if (_active) {
+			end ();
+		}
+	}
+
+	bool
+	pop (Event* e)
+	{
+		if (_rd == _wr) {
+			return false;
+		}
+		*e = _ev[_rd++ & MASK];
+		return true;
+	}
+
+	uint64_t dropped () const { return _dropped; }
+
+private:
+	void
+	end ()
+	{
+		_active     = false;
+		_cur.length = _frames - _cur.start;
+		if (_wr - _rd < SIZE) {
+			_ev[_wr++ & MASK] = _cur;
+		} else {
+			++_dropped;
+		}
+	}
+
+	float    _threshold;
+	int64_t  _frames;
+	bool     _active;
+	Event    _cur;
+	uint32_t _rd;
+	uint32_t _wr;
+	uint64_t _dropped;
+	Event    _ev[SIZE];
+};
+
+#endif
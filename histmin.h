@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2010-2018 Fons Adriaensen <fons@linuxaudio.org>
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HISTMIN_H
+#define _HISTMIN_H
+
+#include <assert.h>
+
+/* Minimum of the last `hlen` values written, once per chunk.
+ * Used by Peaklim and PeaklimBatch.
+ */
+class Histmin
+{
+public:
+	void
+	init (int hlen)
+	{
+		assert (hlen <= SIZE);
+		_hlen = hlen;
+		_hold = hlen;
+		_wind = 0;
+		_vmin = 1;
+		for (int i = 0; i < SIZE; i++) {
+			_hist[i] = _vmin;
+		}
+	}
+
+	float
+	write (float v)
+	{
+		int i    = _wind;
+		_hist[i] = v;
+
+		if (v <= _vmin) {
+			_vmin = v;
+			_hold = _hlen;
+		} else if (--_hold == 0) {
+			_vmin = v;
+			_hold = _hlen;
+			for (int j = 1 - _hlen; j < 0; j++) {
+				v = _hist[(i + j) & MASK];
+				if (v < _vmin) {
+					_vmin = v;
+					_hold = _hlen + j;
+				}
+			}
+		}
+		_wind = ++i & MASK;
+		return _vmin;
+	}
+
+	float vmin () const { return _vmin; }
+	int   hlen () const { return _hlen; }
+
+private:
+	enum {
+		SIZE = 32,
+		MASK = SIZE - 1
+	};
+
+	int   _hlen;
+	int   _hold;
+	int   _wind;
+	float _vmin;
+	float _hist[SIZE];
+};
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LATENCYHIST_H
+#define _LATENCYHIST_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* HDR-style histogram of durations in nanoseconds.
+ *
+ * Values below 32 ns are exact, above that each power of two is split
+ * into 16 linear bins, so any recorded value is resolved within 6.25%.
+ * Recording is constant time and does not allocate.
+ */
+class LatencyHist
+{
+public:
+	enum {
+		SUB  = 16,
+		BINS = 2 * SUB + SUB * 59
+	};
+
+	LatencyHist ()
+	{
+		reset ();
+	}
+
+	void
+	reset ()
+	{
+		memset (_bins, 0, sizeof (_bins));
+		_count = 0;
+		_max   = 0;
+		_sum   = 0;
+	}
+
+	void
+	record (uint64_t ns)
+	{
+		++_bins[index (ns)];
+		++_count;
+		_sum += ns;
+		if (ns > _max) {
+			_max = ns;
+		}
+	}
+
+	uint64_t count () const { return _count; }
+	uint64_t max () const { return _max; }
+
+	double
+	mean () const
+	{
+		return _count > 0 ? _sum / (double)_count : 0;
+	}
+
+	/* upper bound of the value below which `p` percent of records are */
+	uint64_t
+	percentile (double p) const
+	{
+		if (_count == 0) {
+			return 0;
+		}
+		uint64_t want = (uint64_t)(p * 0.01 * _count + 0.5);
+		if (want < 1) {
+			want = 1;
+		}
+		uint64_t n = 0;
+		for (int i = 0; i < BINS; ++i) {
+			n += _bins[i];
+			if (n >= want) {
+				uint64_t v = upper (i);
+				return v < _max ? v : _max;
+			}
+		}
+		return _max;
+	}
+
+	static uint64_t
+	now ()
+	{
+		struct timespec ts;
+		clock_gettime (CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+private:
+	static int
+	index (uint64_t v)
+	{
+		if (v < 2 * SUB) {
+			return v;
+		}
+		int shift = 63 - __builtin_clzll (v) - 4; /* v >> shift is in [16, 32) */
+		return SUB * shift + (v >> shift);
+	}
+
+	static uint64_t
+	upper (int i)
+	{
+		if (i < 2 * SUB) {
+			return i;
+		}
+		int shift = i / SUB - 1;
+		return ((uint64_t)(i - SUB * shift + 1) << shift) - 1;
+	}
+
+	uint64_t _bins[BINS];
+	uint64_t _count;
+	uint64_t _max;
+	uint64_t _sum;
+};
+
+#endif
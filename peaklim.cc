@@ -20,62 +20,83 @@
 #include <assert.h>
 #include <math.h>
 #include <string.h>
+#include <utility>
 
 #include "peaklim.h"
 
-void
-Peaklim::Histmin::init (int hlen)
-{
-	assert (hlen <= SIZE);
-	_hlen = hlen;
-	_hold = hlen;
-	_wind = 0;
-	_vmin = 1;
-	for (int i = 0; i < SIZE; i++) {
-		_hist[i] = _vmin;
+/* gain coefficient at the lower end of each 0.1 dB histogram bin */
+static struct GainEdges {
+	GainEdges ()
+	{
+		for (int i = 0; i <= Peaklim::HIST_BINS; ++i) {
+			v[i] = powf (10.f, -0.005f * i);
+		}
 	}
-}
+	float v[Peaklim::HIST_BINS + 1];
+} const gr_edge;
 
-float
-Peaklim::Histmin::write (float v)
+Peaklim::Coeffs::Coeffs (float fsamp)
 {
-	int i    = _wind;
-	_hist[i] = v;
-
-	if (v <= _vmin) {
-		_vmin = v;
-		_hold = _hlen;
-	} else if (--_hold == 0) {
-		_vmin = v;
-		_hold = _hlen;
-		for (int j = 1 - _hlen; j < 0; j++) {
-			v = _hist[(i + j) & MASK];
-			if (v < _vmin) {
-				_vmin = v;
-				_hold = _hlen + j;
-			}
-		}
+	if (fsamp > 130000) {
+		div1 = 32;
+	} else if (fsamp > 65000) {
+		div1 = 16;
+	} else {
+		div1 = 8;
 	}
-	_wind = ++i & MASK;
-	return _vmin;
+
+	int k1 = (int)(ceilf (1.2e-3f * fsamp / div1));
+
+	div2  = 8;
+	hold1 = k1 + 1;
+	hold2 = 12;
+	delay = k1 * div1;
+	wlf   = 6.28f * 500.f / fsamp;
+	w1    = 10.f / delay;
+	w2    = w1 / div2;
+	w3    = 1.f / (0.01f * fsamp); /* default release */
 }
 
 Peaklim::Peaklim (void)
-    : _fsamp (0)
-    , _nchan (0)
+    : _nchan (0)
+    , _tail (0)
     , _truepeak (false)
+    , _sparse (false)
+    , _frames (false)
+    , _arena (0)
+    , _arena_size (0)
     , _dly_buf (0)
     , _zlf (0)
+    , _chn_peak (0)
+    , _wpk (0)
+    , _zpk (0)
+    , _tpk (0)
+    , _timing (0)
+    , _events (0)
+    , _fsamp (0)
     , _rstat (false)
     , _peak (0)
     , _gmax (1)
     , _gmin (1)
+    , _gr_hist (0)
+    , _gr_events (0)
+    , _gr_active (false)
+    , _gr_bin (0)
 {
 }
 
+Peaklim::Peaklim (Peaklim&& o)
+    : Peaklim ()
+{
+	*this = std::move (o);
+}
+
 Peaklim::~Peaklim (void)
 {
 	fini ();
+	delete _timing;
+	delete _events;
+	delete[] _gr_hist;
 }
 
 void
@@ -102,13 +123,48 @@ Peaklim::set_release (float v)
 	_w3 = 1.f / (v * _fsamp);
 }
 
+void
+Peaklim::set_sparse (bool v)
+{
+	_sparse = v;
+}
+
+void
+Peaklim::set_timing (bool v)
+{
+	if (v && !_timing) {
+		_timing = new LatencyHist ();
+	} else if (!v) {
+		delete _timing;
+		_timing = 0;
+	}
+}
+
+void
+Peaklim::set_histogram (bool v)
+{
+	if (v && !_gr_hist) {
+		_gr_hist = new uint64_t[HIST_BINS] ();
+	} else if (!v) {
+		delete[] _gr_hist;
+		_gr_hist = 0;
+	}
+}
+
+void
+Peaklim::set_event_log (float db)
+{
+	delete _events;
+	_events = db > 0 ? new GrEventLog (powf (10.f, -0.05f * db)) : 0;
+}
+
 void
 Peaklim::set_truepeak (bool v)
 {
 	if (_truepeak == v) {
 		return;
 	}
-	_upsampler.init (_nchan);
+	_upsampler.reset ();
 	_truepeak = v;
 }
 
@@ -125,49 +181,37 @@ Peaklim::init (float fsamp, int nchan)
 		return;
 	}
 
-	_fsamp = fsamp;
+	Coeffs c (fsamp);
 
-	if (fsamp > 130000) {
-		_div1 = 32;
-	} else if (fsamp > 65000) {
-		_div1 = 16;
-	} else {
-		_div1 = 8;
-	}
-
-	_nchan = nchan;
-	_div2  = 8;
-	int k1 = (int)(ceilf (1.2e-3f * fsamp / _div1));
-	int k2 = 12;
-	_delay = k1 * _div1;
-
-	int dly_size;
-	for (dly_size = 64; dly_size < _delay + _div1; dly_size *= 2) ;
+	_fsamp  = fsamp;
+	_div1   = c.div1;
+	_div2   = c.div2;
+	_delay  = c.delay;
+	_nchan  = nchan;
+	_frames = nchan >= FRAME_MAJOR_NCHAN;
 
+	/* A multiple of _div1, so that chunks never wrap around.
+	 * One block, interleaved for frame-major processing,
+	 * otherwise one contiguous line per channel.
+	 */
+	_dly_size  = _delay + _div1;
+	_dly_ridx  = 0;
+	_dly_step  = _frames ? _nchan : 1;
+	_tail      = _delay;
 
-	_dly_mask = dly_size - 1;
-	_dly_ridx = 0;
+	_upsampler.init (_nchan, _frames, map_arena ());
 
-	_dly_buf = new float*[_nchan];
-	_zlf     = new float[_nchan];
-
-	for (int i = 0; i < _nchan; i++) {
-		_dly_buf[i] = new float[dly_size];
-		memset (_dly_buf[i], 0, dly_size * sizeof (float));
-		_zlf[i] = 0.f;
-	}
-
-	_hist1.init (k1 + 1);
-	_hist2.init (k2);
+	_hist1.init (c.hold1);
+	_hist2.init (c.hold2);
 
 	_c1  = _div1;
 	_c2  = _div2;
 	_m1  = 0.f;
 	_m2  = 0.f;
-	_wlf = 6.28f * 500.f / fsamp;
-	_w1  = 10.f / _delay;
-	_w2  = _w1 / _div2;
-	_w3  = 1.f / (0.01f * fsamp);
+	_wlf = c.wlf;
+	_w1  = c.w1;
+	_w2  = c.w2;
+	_w3  = c.w3;
 	_z1  = 1.f;
 	_z2  = 1.f;
 	_z3  = 1.f;
@@ -179,19 +223,251 @@ Peaklim::init (float fsamp, int nchan)
 	_peak = 0.f;
 	_gmax = 1.f;
 	_gmin = 1.f;
+
+	if (_gr_hist) {
+		memset (_gr_hist, 0, HIST_BINS * sizeof (uint64_t));
+	}
+	_gr_events = 0;
+	_gr_active = false;
+	_gr_bin    = 0;
+
+	if (_events) {
+		_events->reset ();
+	}
+}
+
+/* One allocation holds the delay-line pointers, delay-lines, _zlf,
+ * _chn_peak, _wpk/_zpk/_tpk and the upsampler history, each 16 byte
+ * aligned. Allocates the arena if needed, points the members into it
+ * and returns the upsampler history.
+ */
+float*
+Peaklim::map_arena ()
+{
+	size_t n_ptr = (_nchan * sizeof (float*) + 15) & ~15;
+	size_t n_dly = (_dly_size * _nchan * sizeof (float) + 15) & ~15;
+	size_t n_chn = (7 * _nchan * sizeof (float) + 15) & ~15;
+	size_t n_ups = Upsampler::mem_size (_nchan, _frames) * sizeof (float);
+
+	if (!_arena) {
+		_arena_size = n_ptr + n_dly + n_chn + n_ups;
+		_arena      = new char[_arena_size];
+		memset (_arena, 0, _arena_size);
+	}
+
+	float* dly = (float*)&_arena[n_ptr];
+	_dly_buf   = (float**)_arena;
+	_zlf       = (float*)&_arena[n_ptr + n_dly];
+	_chn_peak  = &_zlf[_nchan];
+	_wpk       = &_chn_peak[3 * _nchan];
+	_zpk       = &_wpk[_nchan];
+	_tpk       = &_wpk[2 * _nchan];
+
+	for (int i = 0; i < _nchan; i++) {
+		_dly_buf[i] = _frames ? &dly[i] : &dly[i * _dly_size];
+	}
+
+	return (float*)&_arena[n_ptr + n_dly + n_chn];
+}
+
+/* everything but the arena, the pointers into it and the upsampler */
+void
+Peaklim::copy_params (Peaklim const& o)
+{
+	_g0       = o._g0;
+	_g1       = o._g1;
+	_dg       = o._dg;
+	_gt       = o._gt;
+	_m1       = o._m1;
+	_m2       = o._m2;
+	_w1       = o._w1;
+	_w2       = o._w2;
+	_w3       = o._w3;
+	_wlf      = o._wlf;
+	_z1       = o._z1;
+	_z2       = o._z2;
+	_z3       = o._z3;
+	_c1       = o._c1;
+	_c2       = o._c2;
+	_dly_ridx = o._dly_ridx;
+	_tail     = o._tail;
+	_nchan    = o._nchan;
+	_delay    = o._delay;
+	_dly_size = o._dly_size;
+	_dly_step = o._dly_step;
+	_div1     = o._div1;
+	_div2     = o._div2;
+	_truepeak = o._truepeak;
+	_sparse   = o._sparse;
+	_frames   = o._frames;
+	_hist1    = o._hist1;
+	_hist2    = o._hist2;
+	_fsamp    = o._fsamp;
+	_rstat    = o._rstat;
+	_peak     = o._peak;
+	_gmax     = o._gmax;
+	_gmin     = o._gmin;
+
+	_gr_events = o._gr_events;
+	_gr_active = o._gr_active;
+	_gr_bin    = o._gr_bin;
+}
+
+void
+Peaklim::assign (Peaklim const& o)
+{
+	if (this == &o) {
+		return;
+	}
+
+	if (_nchan != o._nchan || _dly_size != o._dly_size || _frames != o._frames) {
+		fini ();
+	}
+
+	copy_params (o);
+
+	if (o._arena) {
+		map_arena (); /* allocate if needed */
+		memcpy (_arena, o._arena, _arena_size);
+		/* the copied pointer table refers to the source */
+		_upsampler.assign (o._upsampler, map_arena ());
+	}
+
+	if (o._timing) {
+		if (!_timing) {
+			_timing = new LatencyHist ();
+		}
+		*_timing = *o._timing;
+	} else {
+		delete _timing;
+		_timing = 0;
+	}
+
+	delete _events;
+	_events = o._events ? new GrEventLog (*o._events) : 0;
+
+	if (o._gr_hist) {
+		set_histogram (true);
+		memcpy (_gr_hist, o._gr_hist, HIST_BINS * sizeof (uint64_t));
+	} else {
+		set_histogram (false);
+	}
+}
+
+Peaklim
+Peaklim::clone () const
+{
+	Peaklim p;
+	p.assign (*this);
+	return p;
+}
+
+Peaklim&
+Peaklim::operator= (Peaklim&& o)
+{
+	if (this == &o) {
+		return *this;
+	}
+
+	fini ();
+	delete _timing;
+	delete _events;
+	delete[] _gr_hist;
+
+	copy_params (o);
+
+	/* the arena keeps its address, pointers into it remain valid */
+	_arena      = o._arena;
+	_arena_size = o._arena_size;
+	_timing     = o._timing;
+	_events     = o._events;
+	_gr_hist    = o._gr_hist;
+	if (_arena) {
+		_upsampler.assign (o._upsampler, map_arena ());
+	}
+
+	o._arena  = 0;
+	o._timing = 0;
+	o._events  = 0;
+	o._gr_hist = 0;
+	o.fini ();
+	return *this;
 }
 
 void
 Peaklim::fini (void)
 {
-	for (int i = 0; i < _nchan; i++) {
-		delete[] _dly_buf[i];
-		_dly_buf[i] = 0;
+	_upsampler.fini ();
+	delete[] _arena;
+	_arena      = 0;
+	_arena_size = 0;
+	_dly_buf    = 0;
+	_zlf        = 0;
+	_chn_peak   = 0;
+	_wpk        = 0;
+	_zpk        = 0;
+	_tpk        = 0;
+	_nchan      = 0;
+}
+
+size_t
+Peaklim::get_size () const
+{
+	return sizeof (Peaklim) + _arena_size + (_timing ? sizeof (LatencyHist) : 0) + (_events ? sizeof (GrEventLog) : 0) + (_gr_hist ? HIST_BINS * sizeof (uint64_t) : 0);
+}
+
+int64_t
+Peaklim::get_preroll (int64_t start) const
+{
+	/* the longer of both hold windows, and 12 release time-constants,
+	 * leaving a relative gain error below -100 dB */
+	int     hold = std::max (_hist1.hlen () * _div1, _hist2.hlen () * _div1 * _div2);
+	int64_t pre  = _delay + hold + (int)ceilf (12.f / _w3);
+	if (pre >= start) {
+		return start;
+	}
+	/* begin at a multiple of the gain update period */
+	int64_t period = _div1 * _div2;
+	return start - ((start - pre) / period) * period;
+}
+
+void
+Peaklim::reset_stats ()
+{
+	_rstat = false;
+	_peak  = 0;
+	_gmax  = 1;
+	_gmin  = 1;
+
+	if (_gr_hist) {
+		memset (_gr_hist, 0, HIST_BINS * sizeof (uint64_t));
+	}
+	_gr_events = 0;
+	_gr_active = false;
+	if (_chn_peak) {
+		memset (_chn_peak, 0, 3 * _nchan * sizeof (float));
+	}
+	if (_events) {
+		_events->reset ();
+	}
+}
+
+uint64_t
+Peaklim::get_frames_above (float db) const
+{
+	if (!_gr_hist) {
+		return 0;
 	}
-	delete[] _dly_buf;
-	delete[] _zlf;
-	_zlf   = 0;
-	_nchan = 0;
+	/* bins start at multiples of 0.1 dB, 10.f * db may be off by an ulp */
+	int b = lrintf (10.f * db);
+	if (b < 0) {
+		b = 0;
+	}
+	uint64_t n = 0;
+	for (; b < HIST_BINS; ++b) {
+		n += _gr_hist[b];
+	}
+	return n;
 }
 
 /*
@@ -205,6 +481,21 @@ Peaklim::fini (void)
  * _m2 : low-pass filtered (_wlf) digital-peak (reset per _div2 cycle)
  *
  * _zlf[] helper to calc _m2 (per channel LPF'ed input) with input-gain applied
+ *        The one-pole is evaluated serially. A block scan (powers of
+ *        1 - _wlf, 8 samples per step) needs more operations per sample
+ *        than it saves, the recursion overlaps with the gain stage.
+ *
+ * _chn_peak[] per channel input, output and true-peak maxima
+ *
+ * _sparse : only run the true-peak FIR where the result can matter.
+ *           The interpolated peak of a window is bounded by the
+ *           window's digital peak times the filter's L1 norm.
+ *
+ * _frames : with many channels, process all channels of a frame at
+ *           once. Input-gain, delay-write and _zlf run in lanes over the
+ *           interleaved input, the true-peak FIR channel-major.
+ *           _wpk[], _zpk[] and _tpk[] are the per-channel maxima of the
+ *           input, _zlf and true-peak in the current chunk.
  *
  * _c1 : coarse chunk-size (sr dependent), count-down _div1
  * _c2 : 8x divider of _c1 cycle
@@ -223,17 +514,42 @@ Peaklim::fini (void)
  * _w2 : _w1 / _div2
  * _w3 : user-set release time
  *
+ * _dly_buf[j][i * _dly_step] : delay-line of channel j, interleaved
+ *                              with _frames, _dly_step is 1 otherwise
  * _dly_ridx: offset in delay ringbuffer
  * ri, wi; read/write indices
+ *
+ * _gr_hist: optional, applied gain-reduction (_z3) sampled once per chunk,
+ *           weighted by the number of frames in the chunk
+ * _gr_events: count of chunks where _h1 or _h2 start to attenuate
+ * _events: optional log of gain-reduction events, updated per chunk
  */
+int
+Peaklim::drain (float* out, int nframes)
+{
+	if (nframes > _tail) {
+		nframes = _tail;
+	}
+	if (nframes > 0) {
+		process (nframes, 0, out);
+		_tail -= nframes;
+	}
+	return nframes;
+}
+
 void
 Peaklim::process (int nframes, float const* inp, float* out)
 {
 	int   ri, wi;
 	float h1, h2, m1, m2, z1, z2, z3, pk, t0, t1;
 
+	uint64_t t_start = _timing ? LatencyHist::now () : 0;
+
 	ri = _dly_ridx;
-	wi = (ri + _delay) & _dly_mask;
+	wi = ri + _delay;
+	if (wi >= _dly_size) {
+		wi -= _dly_size;
+	}
 	h1 = _hist1.vmin ();
 	h2 = _hist2.vmin ();
 	m1 = _m1;
@@ -255,36 +571,168 @@ Peaklim::process (int nframes, float const* inp, float* out)
 
 	int k = 0;
 	while (nframes) {
-		int   n = (_c1 < nframes) ? _c1 : nframes;
-		float g = _g0;
-		for (int j = 0; j < _nchan; j++) {
-			float z = _zlf[j];
-			float d = _dg;
-			g       = _g0;
+		int   n  = (_c1 < nframes) ? _c1 : nframes;
+		float g  = _g0;
+		float mf = 0;
+		if (!inp) {
+			/* drain: the input is silence, the low-pass decays in closed
+			 * form and only the upsampler history needs to be processed.
+			 */
+			float const a = 1.f - _wlf;
+			for (int j = 0; j < _nchan; j++) {
+				m2 = fmaxf (m2, a * fabsf (_zlf[j]));
+				_zlf[j] *= powf (a, n);
+			}
+			if (_frames) {
+				memset (&_dly_buf[0][wi * _nchan], 0, n * _nchan * sizeof (float));
+			} else {
+				for (int j = 0; j < _nchan; j++) {
+					memset (&_dly_buf[j][wi], 0, n * sizeof (float));
+				}
+			}
+			/* the history is clear after 47 samples */
+			int nt = _truepeak ? std::min (n, 47 - (_delay - _tail + k)) : 0;
+			for (int i = 0; i < nt; i++) {
+				if (_frames) {
+					_upsampler.process_frame (&_dly_buf[0][(wi + i) * _nchan], _tpk);
+				}
+				for (int j = 0; j < _nchan; j++) {
+					float x = _frames ? _tpk[j] : _upsampler.process_one (j, 0.f);
+					if (x > _chn_peak[3 * j + 2]) {
+						_chn_peak[3 * j + 2] = x;
+					}
+					if (x > m1) {
+						m1 = x;
+					}
+				}
+			}
+			g += n * _dg;
+		} else if (_frames) {
+			float const* x   = &inp[k * _nchan];
+			float*       b   = &_dly_buf[0][wi * _nchan];
+			float*       zlf = _zlf;
+			float*       wpk = _wpk;
+			float*       zpk = _zpk;
+			float const  wlf = _wlf;
+			float const  d   = _dg;
+			int const    nc  = _nchan;
+			for (int j = 0; j < nc; j++) {
+				wpk[j] = 0;
+				zpk[j] = 0;
+			}
 			for (int i = 0; i < n; i++) {
-				float x = g * inp[j + (i + k) * _nchan];
+				for (int j = 0; j < nc; j++) {
+					float v = g * x[j];
+					float z = zlf[j];
+					z += wlf * (v - z) + 1e-20f;
+					b[j]   = v;
+					zlf[j] = z;
+					wpk[j] = fmaxf (wpk[j], fabsf (v));
+					zpk[j] = fmaxf (zpk[j], fabsf (z));
+				}
 				g += d;
-				_dly_buf[j][wi + i] = x;
-				z += _wlf * (x - z) + 1e-20f;
+				x += nc;
+				b += nc;
+			}
+			for (int j = 0; j < _nchan; j++) {
+				_chn_peak[3 * j] = fmaxf (_chn_peak[3 * j], _wpk[j]);
+				mf               = fmaxf (mf, _wpk[j]);
+				m2               = fmaxf (m2, _zpk[j]);
+			}
+			if (!_truepeak && mf > m1) {
+				m1 = mf;
+			}
+		} else {
+			for (int j = 0; j < _nchan; j++) {
+				float* b  = &_dly_buf[j][wi];
+				float  z  = _zlf[j];
+				float  d  = _dg;
+				float  mw = 0;
+				g         = _g0;
+				for (int i = 0; i < n; i++) {
+					float x = g * inp[j + (i + k) * _nchan];
+					g += d;
+					b[i] = x;
+					z += _wlf * (x - z) + 1e-20f;
 
-				if (_truepeak) {
-					x = _upsampler.process_one (j, x);
-				} else {
 					x = fabsf (x);
+					if (x > mw) {
+						mw = x;
+					}
+					x = fabsf (z);
+					if (x > m2) {
+						m2 = x;
+					}
+				}
+				_zlf[j] = z;
+
+				if (mw > _chn_peak[3 * j]) {
+					_chn_peak[3 * j] = mw;
+				}
+
+				if (!_truepeak) {
+					if (mw > m1) {
+						m1 = mw;
+					}
+					continue;
 				}
 
-				if (x > m1) {
-					m1 = x;
+				float pt = _chn_peak[3 * j + 2];
+
+				if (_sparse) {
+					/* skip the FIR if the interpolated peak can not exceed
+					 * the channel's true-peak so far, nor the current
+					 * chunk's peak or the threshold.
+					 */
+					float bound = Upsampler::gain_bound () * fmaxf (mw, _upsampler.hist_peak (j));
+					if (bound <= pt && (bound <= m1 || bound * _gt <= 1.f)) {
+						_upsampler.skip (j, b, n);
+						continue;
+					}
 				}
-				x = fabsf (z);
-				if (x > m2) {
-					m2 = x;
+
+				for (int i = 0; i < n; i++) {
+					float x = _upsampler.process_one (j, b[i]);
+					if (x > pt) {
+						pt = x;
+					}
+					if (x > m1) {
+						m1 = x;
+					}
 				}
+				_chn_peak[3 * j + 2] = pt;
 			}
-			_zlf[j] = z;
 		}
 		_g0 = g;
 
+		if (_frames && _truepeak && inp) {
+			bool skip = false;
+			if (_sparse) {
+				float bound = Upsampler::gain_bound () * fmaxf (mf, _upsampler.hist_peak_frames ());
+				skip        = bound <= m1 || bound * _gt <= 1.f;
+				for (int j = 0; skip && j < _nchan; j++) {
+					skip = bound <= _chn_peak[3 * j + 2];
+				}
+			}
+			for (int i = 0; i < n; i++) {
+				float const* b = &_dly_buf[0][(wi + i) * _nchan];
+				if (skip) {
+					_upsampler.push_frame (b);
+					continue;
+				}
+				_upsampler.process_frame (b, _tpk);
+				for (int j = 0; j < _nchan; j++) {
+					float x = _tpk[j];
+					if (x > _chn_peak[3 * j + 2]) {
+						_chn_peak[3 * j + 2] = x;
+					}
+					if (x > m1) {
+						m1 = x;
+					}
+				}
+			}
+		}
+
 		_c1 -= n;
 		if (_c1 == 0) {
 			m1 *= _gt;
@@ -309,6 +757,17 @@ Peaklim::process (int nframes, float const* inp, float* out)
 					_dg /= _div1 * _div2;
 				}
 			}
+			if (h1 < 1.f || h2 < 1.f) {
+				if (!_gr_active) {
+					++_gr_events;
+				}
+				_gr_active = true;
+			} else {
+				_gr_active = false;
+			}
+			if (_events) {
+				_events->chunk (_div1, fminf (h1, h2));
+			}
 		}
 
 		for (int i = 0; i < n; i++) {
@@ -326,13 +785,37 @@ Peaklim::process (int nframes, float const* inp, float* out)
 			if (z3 < t0) {
 				t0 = z3;
 			}
+			int o = (ri + i) * _dly_step;
 			for (int j = 0; j < _nchan; j++) {
-				out[j + (k + i) * _nchan] = z3 * _dly_buf[j][ri + i];
+				out[j + (k + i) * _nchan] = z3 * _dly_buf[j][o];
 			}
 		}
 
-		wi = (wi + n) & _dly_mask;
-		ri = (ri + n) & _dly_mask;
+		/* output peaks of the chunk, kept in a local, not stored per sample */
+		for (int j = 0; j < _nchan; j++) {
+			float const* y  = &out[j + k * _nchan];
+			float        pk = _chn_peak[3 * j + 1];
+			for (int i = 0; i < n; i++) {
+				pk = fmaxf (pk, fabsf (y[i * _nchan]));
+			}
+			_chn_peak[3 * j + 1] = pk;
+		}
+
+		/* z3 changes slowly, start search at the previous bin */
+		if (_gr_hist) {
+			int b = _gr_bin;
+			while (b > 0 && z3 > gr_edge.v[b]) {
+				--b;
+			}
+			while (b < HIST_BINS - 1 && z3 <= gr_edge.v[b + 1]) {
+				++b;
+			}
+			_gr_hist[b] += n;
+			_gr_bin = b;
+		}
+
+		wi = (wi + n < _dly_size) ? wi + n : 0;
+		ri = (ri + n < _dly_size) ? ri + n : 0;
 		k += n;
 		nframes -= n;
 	}
@@ -347,4 +830,12 @@ Peaklim::process (int nframes, float const* inp, float* out)
 	_peak     = pk;
 	_gmin     = t0;
 	_gmax     = t1;
+
+	if (inp) {
+		_tail = _delay;
+	}
+
+	if (_timing) {
+		_timing->record (LatencyHist::now () - t_start);
+	}
 }
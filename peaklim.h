@@ -19,16 +19,49 @@
 #ifndef _PEAKLIM_H
 #define _PEAKLIM_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "greventlog.h"
+#include "histmin.h"
+#include "latencyhist.h"
 #include "upsampler.h"
 
 class Peaklim
 {
 public:
+	enum {
+		HIST_BINS         = 400, /* gain-reduction histogram, 0.1 dB per bin */
+		FRAME_MAJOR_NCHAN = 4    /* process all channels of a frame at once */
+	};
+
+	/* Sample-rate dependent constants of the gain computer,
+	 * also used by PeaklimBatch.
+	 */
+	struct Coeffs {
+		Coeffs (float fsamp);
+
+		int   div1;  /* frames per chunk, one _hist1 entry */
+		int   div2;  /* chunks per _hist2 entry */
+		int   hold1; /* Histmin lengths */
+		int   hold2;
+		int   delay; /* lookahead */
+		float w1, w2, w3, wlf;
+	};
+
 	Peaklim (void);
 	~Peaklim (void);
 
+	Peaklim (Peaklim&&);
+	Peaklim& operator= (Peaklim&&);
+
+	/* Copy the complete state of another instance, statistics included.
+	 * Processing continues from the same point. The arena is reused if
+	 * the layout matches, a fork then costs one memcpy.
+	 */
+	void    assign (Peaklim const&);
+	Peaklim clone () const;
+
 	void init (float fsamp, int nchan);
 	void fini (void);
 
@@ -37,12 +70,40 @@ public:
 	void set_release (float);
 	void set_truepeak (bool);
 
+	/* Evaluate true-peak only where it can exceed the threshold.
+	 * The output is identical, but peak statistics below the
+	 * threshold are not accurate.
+	 */
+	void set_sparse (bool);
+
 	int
 	get_latency () const
 	{
 		return _delay;
 	}
 
+	int
+	get_nchan () const
+	{
+		return _nchan;
+	}
+
+	/* The output only depends on where process() calls are split if
+	 * the split is not at a multiple of this, counted from init().
+	 */
+	int
+	get_chunksize () const
+	{
+		return _div1;
+	}
+
+	/* Frames to process before `start` for the output from there on to
+	 * match processing from the beginning: the lookahead, Histmin windows
+	 * and release (depends on the release-time), extended so that chunk
+	 * boundaries are in the same place. At most `start`.
+	 */
+	int64_t get_preroll (int64_t start) const;
+
 	void
 	get_stats (float* peak, float* gmax, float* gmin)
 	{
@@ -52,54 +113,131 @@ public:
 		_rstat = true;
 	}
 
+	/* optionally count frames per 0.1 dB of applied gain-reduction */
+	void set_histogram (bool);
+
+	/* frames per 0.1 dB bin, last bin is open, NULL unless enabled */
+	uint64_t const*
+	get_histogram () const
+	{
+		return _gr_hist;
+	}
+
+	uint64_t
+	get_events () const
+	{
+		return _gr_events;
+	}
+
+	/* frames with a gain-reduction of at least `db`, which is rounded
+	 * to the 0.1 dB bins of the histogram, 0 unless it is enabled */
+	uint64_t get_frames_above (float db) const;
+
+	/* clear peak, gain-reduction and channel statistics */
+	void reset_stats ();
+
+	/* per-channel peaks since init(), input-peak includes input-gain,
+	 * true-peak is only measured when true-peak mode is enabled.
+	 */
+	void
+	get_channel_stats (int chn, float* inp_peak, float* out_peak, float* true_peak) const
+	{
+		*inp_peak  = _chn_peak[3 * chn];
+		*out_peak  = _chn_peak[3 * chn + 1];
+		*true_peak = _chn_peak[3 * chn + 2];
+	}
+
+	/* optionally measure the duration of each process() call */
+	void set_timing (bool);
+
+	/* per call processing time, NULL unless timing is enabled */
+	LatencyHist*
+	get_timing ()
+	{
+		return _timing;
+	}
+
+	/* optionally log gain-reductions of more than `db`, 0 disables */
+	void set_event_log (float db);
+
+	/* NULL unless the event log is enabled */
+	GrEventLog*
+	get_event_log ()
+	{
+		return _events;
+	}
+
+	/* memory used by this instance in bytes */
+	size_t get_size () const;
+
 	void process (int nsamp, float const* inp, float* out);
 
-private:
-	class Histmin
+	/* End of input: emit up to `nframes` of the remaining delayed
+	 * samples, as if silence was processed, but without detection.
+	 * Returns the number of frames written to `out`.
+	 */
+	int drain (float* out, int nframes);
+
+	/* frames that drain() can still produce */
+	int
+	get_remaining () const
 	{
-	public:
-		void  init (int hlen);
-		float write (float v);
-		float vmin () { return _vmin; }
-
-	private:
-		enum {
-			SIZE = 32,
-			MASK = SIZE - 1
-		};
-
-		int   _hlen;
-		int   _hold;
-		int   _wind;
-		float _vmin;
-		float _hist[SIZE];
-	};
+		return _tail;
+	}
 
-	float _fsamp;
-	int   _nchan;
-	bool  _truepeak;
+private:
+	Peaklim (Peaklim const&);            /* use clone() */
+	Peaklim& operator= (Peaklim const&); /* use assign() */
 
-	float** _dly_buf;
-	float*  _zlf;
+	float* map_arena ();
+	void   copy_params (Peaklim const&);
 
-	int   _delay;
-	int   _dly_mask;
-	int   _dly_ridx;
-	int   _div1, _div2;
-	int   _c1, _c2;
+	/* state and coefficients used for every sample, kept together */
 	float _g0, _g1, _dg;
 	float _gt, _m1, _m2;
 	float _w1, _w2, _w3, _wlf;
 	float _z1, _z2, _z3;
+	int   _c1, _c2;
+	int   _dly_ridx;
+
+	int  _nchan;
+	int  _delay;
+	int  _tail;
+	int  _dly_size;
+	int  _dly_step;
+	int  _div1, _div2;
+	bool _truepeak;
+	bool _sparse;
+	bool _frames;
+
+	/* one allocation for all per-channel state */
+	char*   _arena;
+	size_t  _arena_size;
+	float** _dly_buf;
+	float*  _zlf;
+	float*  _chn_peak;
+	float*  _wpk;
+	float*  _zpk;
+	float*  _tpk;
+
+	LatencyHist* _timing;
+	GrEventLog*  _events;
+
+	Upsampler _upsampler;
+	Histmin   _hist1;
+	Histmin   _hist2;
+
+	float _fsamp;
 
 	bool  _rstat;
 	float _peak;
 	float _gmax;
 	float _gmin;
 
-	Upsampler _upsampler;
-	Histmin   _hist1;
-	Histmin   _hist2;
+	uint64_t* _gr_hist;
+	uint64_t _gr_events;
+	bool     _gr_active;
+	int      _gr_bin;
 };
 
 #endif
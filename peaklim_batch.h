@@ -0,0 +1,379 @@
+/*
+ * Copyright (C) 2010-2018 Fons Adriaensen <fons@linuxaudio.org>
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PEAKLIM_BATCH_H
+#define _PEAKLIM_BATCH_H
+
+#include <math.h>
+#include <string.h>
+
+#include "histmin.h"
+#include "peaklim.h"
+#include "upsampler.h"
+
+/* Keep the per-frame loops over the lanes as loops, so that they are
+ * vectorized. Otherwise they are fully unrolled first, and the lane
+ * state that is carried from frame to frame stays scalar.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+#define PEAKLIM_BATCH_LANES _Pragma ("GCC unroll 1")
+#else
+#define PEAKLIM_BATCH_LANES
+#endif
+
+/* N independent mono limiters, advanced together.
+ *
+ * Each lane has its own gain computer and parameters (input-gain,
+ * threshold, release, true-peak), using Peaklim's coefficients and
+ * Histmin. The per-frame state is kept as arrays over the lanes, so that
+ * all streams are processed in SIMD lanes, one frame at a time. Input
+ * and output are interleaved, one sample per lane per frame, like an
+ * N channel signal.
+ *
+ * The output of a lane matches a mono Peaklim with the same parameters,
+ * exactly for digital-peak, and within float rounding for true-peak
+ * (the channel-major upsampler sums in a different order), see
+ * sound-gambit-batchtest.
+ *
+ * N should be a multiple of the SIMD width (4 or 8).
+ */
+template <int N>
+class PeaklimBatch
+{
+public:
+	PeaklimBatch (void)
+	    : _fsamp (0)
+	    , _tp_any (false)
+	    , _tp_init (false)
+	    , _dly_buf (0)
+	{
+		for (int l = 0; l < N; ++l) {
+			_truepeak[l] = false;
+		}
+	}
+
+	~PeaklimBatch (void)
+	{
+		fini ();
+	}
+
+	void init (float fsamp);
+
+	void
+	fini (void)
+	{
+		delete[] _dly_buf;
+		_dly_buf = 0;
+		_fsamp   = 0;
+	}
+
+	void
+	set_inpgain (int lane, float v)
+	{
+		_g1[lane] = powf (10.f, 0.05f * v);
+	}
+
+	void
+	set_threshold (int lane, float v)
+	{
+		_gt[lane] = powf (10.f, -0.05f * v);
+	}
+
+	void
+	set_release (int lane, float v)
+	{
+		if (v > 1.f) {
+			v = 1.f;
+		}
+		if (v < 1e-3f) {
+			v = 1e-3f;
+		}
+		_w3[lane] = 1.f / (v * _fsamp);
+	}
+
+	/* like Peaklim, a change clears the lane's upsampler history */
+	void
+	set_truepeak (int lane, bool v)
+	{
+		if (v == _truepeak[lane]) {
+			return;
+		}
+		bool any        = false;
+		_truepeak[lane] = v;
+		for (int l = 0; l < N; ++l) {
+			any |= _truepeak[l];
+		}
+		if (_tp_init) {
+			_upsampler.reset (lane);
+		} else if (any) {
+			_upsampler.init (N, true);
+			_tp_init = true;
+		}
+		_tp_any = any;
+	}
+
+	int
+	get_latency () const
+	{
+		return _delay;
+	}
+
+	void
+	get_stats (int lane, float* peak, float* gmax, float* gmin)
+	{
+		*peak        = _peak[lane];
+		*gmax        = _gmax[lane];
+		*gmin        = _gmin[lane];
+		_rstat[lane] = true;
+	}
+
+	void process (int nframes, float const* inp, float* out);
+
+private:
+	float _fsamp;
+	bool  _truepeak[N];
+	bool  _tp_any;  /* any lane uses true-peak */
+	bool  _tp_init; /* _upsampler is initialized */
+
+	float* _dly_buf; /* [frame][lane] */
+
+	int   _delay;
+	int   _dly_mask;
+	int   _dly_ridx;
+	int   _div1, _div2;
+	int   _c1, _c2;
+	float _w1, _w2, _wlf;
+
+	float _g0[N], _g1[N], _dg[N];
+	float _gt[N], _w3[N];
+	float _m1[N], _m2[N];
+	float _z1[N], _z2[N], _z3[N];
+	float _zlf[N];
+
+	bool  _rstat[N];
+	float _peak[N];
+	float _gmax[N];
+	float _gmin[N];
+
+	Upsampler _upsampler;
+	Histmin   _hist1[N];
+	Histmin   _hist2[N];
+};
+
+template <int N>
+void
+PeaklimBatch<N>::init (float fsamp)
+{
+	fini ();
+
+	Peaklim::Coeffs c (fsamp);
+
+	_fsamp = fsamp;
+	_div1  = c.div1;
+	_div2  = c.div2;
+	_delay = c.delay;
+
+	int dly_size;
+	for (dly_size = 64; dly_size < _delay + _div1; dly_size *= 2) ;
+
+	_dly_mask = dly_size - 1;
+	_dly_ridx = 0;
+	_dly_buf  = new float[dly_size * N];
+	memset (_dly_buf, 0, dly_size * N * sizeof (float));
+
+	_c1  = _div1;
+	_c2  = _div2;
+	_wlf = c.wlf;
+	_w1  = c.w1;
+	_w2  = c.w2;
+
+	for (int l = 0; l < N; ++l) {
+		_hist1[l].init (c.hold1);
+		_hist2[l].init (c.hold2);
+
+		_m1[l]  = 0.f;
+		_m2[l]  = 0.f;
+		_w3[l]  = c.w3;
+		_z1[l]  = 1.f;
+		_z2[l]  = 1.f;
+		_z3[l]  = 1.f;
+		_zlf[l] = 0.f;
+		_gt[l]  = 1.f;
+		_g0[l]  = 1.f;
+		_g1[l]  = 1.f;
+		_dg[l]  = 0.f;
+
+		_rstat[l] = false;
+		_peak[l]  = 0.f;
+		_gmax[l]  = 1.f;
+		_gmin[l]  = 1.f;
+	}
+
+	if (_tp_init) {
+		_upsampler.reset ();
+	}
+}
+
+/* see Peaklim::process, the variables are the same, per lane */
+template <int N>
+void
+PeaklimBatch<N>::process (int nframes, float const* inp, float* out)
+{
+	int   ri, wi;
+	float g[N], dg[N], z[N], mw[N], mz[N], tpk[N];
+	float h1[N], h2[N], w3[N], pk[N], t0[N], t1[N];
+	float z1[N], z2[N], z3[N];
+
+	/* local copies, which the compiler can keep in registers */
+	float const wlf = _wlf;
+	float const w1  = _w1;
+	float const w2  = _w2;
+
+	ri = _dly_ridx;
+	wi = (ri + _delay) & _dly_mask;
+
+	for (int l = 0; l < N; ++l) {
+		if (_rstat[l]) {
+			_rstat[l] = false;
+			pk[l]     = 0;
+			t0[l]     = _gmax[l];
+			t1[l]     = _gmin[l];
+		} else {
+			pk[l] = _peak[l];
+			t0[l] = _gmin[l];
+			t1[l] = _gmax[l];
+		}
+		z1[l] = _z1[l];
+		z2[l] = _z2[l];
+		z3[l] = _z3[l];
+		w3[l] = _w3[l];
+	}
+
+	int k = 0;
+	while (nframes) {
+		int n = (_c1 < nframes) ? _c1 : nframes;
+
+		/* input-gain, delay-write and _zlf, all lanes at once */
+		float const* x = &inp[k * N];
+		float*       b = &_dly_buf[wi * N];
+		for (int l = 0; l < N; ++l) {
+			g[l]  = _g0[l];
+			dg[l] = _dg[l];
+			z[l]  = _zlf[l];
+			mw[l] = 0;
+			mz[l] = 0;
+		}
+		for (int i = 0; i < n; i++) {
+			PEAKLIM_BATCH_LANES
+			for (int l = 0; l < N; ++l) {
+				float v = g[l] * x[l];
+				g[l] += dg[l];
+				b[l] = v;
+				z[l] += wlf * (v - z[l]) + 1e-20f;
+				mw[l] = fmaxf (mw[l], fabsf (v));
+				mz[l] = fmaxf (mz[l], fabsf (z[l]));
+			}
+			x += N;
+			b += N;
+		}
+		for (int l = 0; l < N; ++l) {
+			_g0[l]  = g[l];
+			_zlf[l] = z[l];
+			_m2[l]  = fmaxf (_m2[l], mz[l]);
+			if (!_truepeak[l]) {
+				_m1[l] = fmaxf (_m1[l], mw[l]);
+			}
+		}
+
+		if (_tp_any) {
+			for (int i = 0; i < n; i++) {
+				_upsampler.process_frame (&_dly_buf[(wi + i) * N], tpk);
+				for (int l = 0; l < N; ++l) {
+					if (_truepeak[l]) {
+						_m1[l] = fmaxf (_m1[l], tpk[l]);
+					}
+				}
+			}
+		}
+
+		_c1 -= n;
+		if (_c1 == 0) {
+			for (int l = 0; l < N; ++l) {
+				float m = _m1[l] * _gt[l];
+				pk[l]   = fmaxf (pk[l], m);
+				_m1[l]  = 0;
+				_hist1[l].write ((m > 1.f) ? 1.f / m : 1.f);
+			}
+			_c1 = _div1;
+			if (--_c2 == 0) {
+				for (int l = 0; l < N; ++l) {
+					float m = _m2[l] * _gt[l];
+					_m2[l]  = 0;
+					_hist2[l].write ((m > 1.f) ? 1.f / m : 1.f);
+				}
+				_c2 = _div2;
+				for (int l = 0; l < N; ++l) {
+					_dg[l] = _g1[l] - _g0[l];
+					if (fabsf (_dg[l]) < 1e-9f) {
+						_g0[l] = _g1[l];
+						_dg[l] = 0;
+					} else {
+						_dg[l] /= _div1 * _div2;
+					}
+				}
+			}
+		}
+
+		for (int l = 0; l < N; ++l) {
+			h1[l] = _hist1[l].vmin ();
+			h2[l] = _hist2[l].vmin ();
+		}
+		for (int i = 0; i < n; i++) {
+			float const* b = &_dly_buf[(ri + i) * N];
+			float*       y = &out[(k + i) * N];
+			PEAKLIM_BATCH_LANES
+			for (int l = 0; l < N; ++l) {
+				z1[l] += w1 * (h1[l] - z1[l]);
+				z2[l] += w2 * (h2[l] - z2[l]);
+				float zz = (z2[l] < z1[l]) ? z2[l] : z1[l];
+				float w  = (zz < z3[l]) ? w1 : w3[l];
+				z3[l] += w * (zz - z3[l]);
+				t1[l] = fmaxf (t1[l], z3[l]);
+				t0[l] = fminf (t0[l], z3[l]);
+				y[l]  = z3[l] * b[l];
+			}
+		}
+
+		wi = (wi + n) & _dly_mask;
+		ri = (ri + n) & _dly_mask;
+		k += n;
+		nframes -= n;
+	}
+
+	for (int l = 0; l < N; ++l) {
+		_z1[l]   = z1[l];
+		_z2[l]   = z2[l];
+		_z3[l]   = z3[l];
+		_peak[l] = pk[l];
+		_gmin[l] = t0[l];
+		_gmax[l] = t1[l];
+	}
+	_dly_ridx = ri;
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "peaklim_stream.h"
+
+PeaklimStream::PeaklimStream (void)
+	: _p (0)
+	, _nchan (0)
+	, _block (0)
+	, _skip (0)
+	, _written (0)
+{
+}
+
+void
+PeaklimStream::init (Peaklim* p, int blocksize)
+{
+	_p       = p;
+	_nchan   = p->get_nchan ();
+	_skip    = p->get_latency ();
+	_written = 0;
+
+	/* by default, input and output of a block fit the L1 cache */
+	int chunk = p->get_chunksize ();
+	if (blocksize <= 0) {
+		blocksize = 4096 / _nchan;
+	}
+	_block = blocksize < chunk ? chunk : blocksize - blocksize % chunk;
+}
+
+void
+PeaklimStream::skip (int nframes)
+{
+	_skip += nframes;
+}
+
+int
+PeaklimStream::process (int nframes, float const* inp, float* out)
+{
+	int rv = 0;
+	while (nframes > 0) {
+		int    n = nframes < _block ? nframes : _block;
+		float* o = &out[rv * _nchan];
+		/* o is never ahead of inp, so in-place works */
+		_p->process (n, inp, o);
+		inp += n * _nchan;
+		nframes -= n;
+		rv += discard (o, n);
+	}
+	_written += rv;
+	return rv;
+}
+
+int
+PeaklimStream::flush (float* out, int nframes)
+{
+	int n;
+	while ((n = _p->drain (out, nframes)) > 0) {
+		if ((n = discard (out, n)) > 0) {
+			break;
+		}
+	}
+	_written += n;
+	return n;
+}
+
+/* Drop frames to skip from the start of `buf`, holding `n` frames.
+ * Blocks are not split at the skip position, since the output depends
+ * on process() calls being aligned to chunks.
+ */
+int
+PeaklimStream::discard (float* buf, int n)
+{
+	if (_skip == 0) {
+		return n;
+	}
+	int ns = n < _skip ? n : _skip;
+	memmove (buf, &buf[ns * _nchan], (n - ns) * _nchan * sizeof (float));
+	_skip -= ns;
+	return n - ns;
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _PEAKLIM_STREAM_H
+#define _PEAKLIM_STREAM_H
+
+#include <stdint.h>
+
+#include "peaklim.h"
+
+/* Latency compensated processing of a complete stream.
+ *
+ * The output is aligned with the input: the first get_latency() frames
+ * of limiter output are discarded, and flush() emits the delayed tail
+ * at the end, so that the total output length equals the input length.
+ *
+ * Input of any size is split into blocks of at most get_blocksize()
+ * frames, a multiple of the limiter's chunk-size. Output is written
+ * directly to `out` and no data is buffered, only the frames that
+ * share a block with the discarded latency are moved once.
+ * In-place processing (inp == out) is supported.
+ */
+class PeaklimStream
+{
+public:
+	PeaklimStream (void);
+
+	/* Use an initialized and configured limiter, from its current
+	 * position. A `blocksize` of 0 selects one depending on the
+	 * channel-count.
+	 */
+	void init (Peaklim* p, int blocksize = 0);
+
+	/* discard another `nframes` of output, e.g. to start at a given frame */
+	void skip (int nframes);
+
+	/* Returns the number of frames written to `out`, which is less than
+	 * `nframes` until the latency has passed. `out` must have space
+	 * for `nframes`.
+	 */
+	int process (int nframes, float const* inp, float* out);
+
+	/* After the last input: write up to `nframes` of the remaining
+	 * output, returns the number of frames written, 0 at the end.
+	 */
+	int flush (float* out, int nframes);
+
+	int
+	get_blocksize () const
+	{
+		return _block;
+	}
+
+	/* output frames written so far */
+	int64_t
+	get_position () const
+	{
+		return _written;
+	}
+
+private:
+	int discard (float* buf, int nframes);
+
+	Peaklim* _p;
+	int      _nchan;
+	int      _block;
+	int      _skip;
+	int64_t  _written;
+};
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "regionreader.h"
+#include "trace.h"
+
+RegionReader::RegionReader (void)
+	: _nthreads (0)
+	, _nrunning (0)
+	, _nchan (0)
+	, _nslots (0)
+	, _region (0)
+	, _frames (0)
+	, _start (0)
+	, _nregions (0)
+	, _workers (0)
+	, _slots (0)
+	, _next (0)
+	, _consumed (0)
+	, _stop (false)
+	, _rd_region (0)
+	, _rd_pos (0)
+	, _rd_eof (false)
+	, _rd_error (false)
+{
+	pthread_mutex_init (&_lock, 0);
+	pthread_cond_init (&_cond, 0);
+}
+
+RegionReader::~RegionReader (void)
+{
+	close ();
+	pthread_mutex_destroy (&_lock);
+	pthread_cond_destroy (&_cond);
+}
+
+bool
+RegionReader::open (const char* path, int nthreads, int region, int nslots)
+{
+	close ();
+
+	if (nthreads < 1 || region < 1 || nslots < nthreads) {
+		return false;
+	}
+
+	_workers = (Worker*)calloc (nthreads, sizeof (Worker));
+	if (!_workers) {
+		return false;
+	}
+
+	for (int i = 0; i < nthreads; ++i) {
+		SF_INFO nfo;
+		memset (&nfo, 0, sizeof (SF_INFO));
+		_workers[i].self = this;
+		_workers[i].sf   = sf_open (path, SFM_READ, &nfo);
+		if (!_workers[i].sf || !nfo.seekable) {
+			_nthreads = i + 1;
+			close ();
+			return false;
+		}
+		_nchan  = nfo.channels;
+		_frames = nfo.frames;
+	}
+
+	_nthreads = nthreads;
+	_region   = region;
+	_slots    = (Slot*)calloc (nslots, sizeof (Slot));
+	if (!_slots) {
+		close ();
+		return false;
+	}
+	_nslots = nslots;
+	for (int i = 0; i < nslots; ++i) {
+		_slots[i].buf = (float*)malloc ((size_t)region * _nchan * sizeof (float));
+		if (!_slots[i].buf) {
+			close ();
+			return false;
+		}
+	}
+
+	if (!start (0)) {
+		close ();
+		return false;
+	}
+	return true;
+}
+
+void
+RegionReader::close ()
+{
+	stop ();
+	for (int i = 0; i < _nthreads; ++i) {
+		if (_workers[i].sf) {
+			sf_close (_workers[i].sf);
+		}
+	}
+	for (int i = 0; i < _nslots; ++i) {
+		free (_slots[i].buf);
+	}
+	free (_workers);
+	free (_slots);
+	_workers  = 0;
+	_slots    = 0;
+	_nthreads = 0;
+	_nslots   = 0;
+}
+
+bool
+RegionReader::start (sf_count_t frame)
+{
+	_start     = frame;
+	_nregions  = (_frames - frame + _region - 1) / _region;
+	_next      = 0;
+	_consumed  = 0;
+	_stop      = false;
+	_rd_region = 0;
+	_rd_pos    = 0;
+	_rd_eof    = false;
+	_rd_error  = false;
+	for (int i = 0; i < _nslots; ++i) {
+		_slots[i].ready = false;
+	}
+	for (int i = 0; i < _nthreads; ++i) {
+		if (pthread_create (&_workers[i].thread, 0, run, &_workers[i])) {
+			stop ();
+			return false;
+		}
+		_nrunning = i + 1;
+	}
+	return true;
+}
+
+void
+RegionReader::stop ()
+{
+	if (_nrunning == 0) {
+		return;
+	}
+	pthread_mutex_lock (&_lock);
+	_stop = true;
+	pthread_cond_broadcast (&_cond);
+	pthread_mutex_unlock (&_lock);
+	for (int i = 0; i < _nrunning; ++i) {
+		pthread_join (_workers[i].thread, 0);
+	}
+	_nrunning = 0;
+}
+
+sf_count_t
+RegionReader::seek (sf_count_t frame)
+{
+	if (frame < 0 || frame > _frames) {
+		return -1;
+	}
+	stop ();
+	if (!start (frame)) {
+		return -1;
+	}
+	return frame;
+}
+
+void*
+RegionReader::run (void* arg)
+{
+	Worker* w = (Worker*)arg;
+	Trace::thread_name ("decode", w - w->self->_workers);
+	w->self->decode (w->sf);
+	return 0;
+}
+
+void
+RegionReader::decode (SNDFILE* sf)
+{
+	pthread_mutex_lock (&_lock);
+	while (!_stop) {
+		/* wait for the slot to be released */
+		if (_next - _consumed >= _nslots) {
+			pthread_cond_wait (&_cond, &_lock);
+			continue;
+		}
+		if (_next >= _nregions) {
+			break;
+		}
+		sf_count_t r = _next++;
+		Slot&      s = _slots[r % _nslots];
+		pthread_mutex_unlock (&_lock);
+
+		sf_count_t n = -1;
+		{
+			TraceSpan span ("decode", r);
+			if (sf_seek (sf, _start + r * _region, SEEK_SET) >= 0) {
+				n = sf_readf_float (sf, s.buf, _region);
+			}
+			if (sf_error (sf)) {
+				n = -1;
+			}
+		}
+
+		pthread_mutex_lock (&_lock);
+		s.frames = n;
+		s.region = r;
+		s.ready  = true;
+		pthread_cond_broadcast (&_cond);
+	}
+	pthread_mutex_unlock (&_lock);
+}
+
+sf_count_t
+RegionReader::readf (float* buf, sf_count_t nframes)
+{
+	sf_count_t rv = 0;
+	while (rv < nframes && !_rd_error) {
+		Slot& s = _slots[_rd_region % _nslots];
+
+		if (_rd_eof || _rd_region >= _nregions) {
+			break;
+		}
+
+		{
+			TraceSpan span ("wait-decode", _rd_region);
+			pthread_mutex_lock (&_lock);
+			while (!(s.ready && s.region == _rd_region)) {
+				pthread_cond_wait (&_cond, &_lock);
+			}
+			pthread_mutex_unlock (&_lock);
+		}
+
+		if (s.frames < 0) {
+			_rd_error = true;
+			break;
+		}
+
+		sf_count_t n = s.frames - _rd_pos;
+		if (n > nframes - rv) {
+			n = nframes - rv;
+		}
+		memcpy (&buf[rv * _nchan], &s.buf[_rd_pos * _nchan], n * _nchan * sizeof (float));
+		rv += n;
+		_rd_pos += n;
+
+		if (_rd_pos < s.frames) {
+			continue;
+		}
+		if (s.frames < _region) {
+			/* end of file */
+			_rd_eof = true;
+		}
+
+		/* release the slot */
+		pthread_mutex_lock (&_lock);
+		s.ready = false;
+		++_consumed;
+		pthread_cond_broadcast (&_cond);
+		pthread_mutex_unlock (&_lock);
+		++_rd_region;
+		_rd_pos = 0;
+	}
+	return _rd_error ? -1 : rv;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _REGIONREADER_H
+#define _REGIONREADER_H
+
+#include <pthread.h>
+#include <sndfile.h>
+
+/* Parallel read-ahead for seekable inputs.
+ *
+ * Each decoder thread opens the file independently, and decodes
+ * successive regions of the file into a fixed number of slots.
+ * The consumer reads the regions back in order. Memory is bounded
+ * by nslots * region frames, allocated once.
+ *
+ * This pays off for compressed formats (FLAC, Ogg) where decoding
+ * is slower than limiting.
+ */
+class RegionReader
+{
+public:
+	RegionReader (void);
+	~RegionReader (void);
+
+	/* open `nthreads` decoders, buffering up to `nslots` regions */
+	bool open (const char* path, int nthreads, int region, int nslots);
+	void close ();
+
+	bool
+	enabled () const
+	{
+		return _nthreads > 0;
+	}
+
+	/* like sf_seek (SEEK_SET), restarts decoding at the given frame */
+	sf_count_t seek (sf_count_t frame);
+
+	/* like sf_readf_float (), returns -1 after a read error */
+	sf_count_t readf (float* buf, sf_count_t nframes);
+
+private:
+	struct Slot {
+		float*     buf;
+		sf_count_t frames; /* -1 on a read error */
+		sf_count_t region;
+		bool       ready;
+	};
+
+	struct Worker {
+		RegionReader* self;
+		SNDFILE*      sf;
+		pthread_t     thread;
+	};
+
+	static void* run (void*);
+
+	void decode (SNDFILE*);
+	bool start (sf_count_t frame);
+	void stop ();
+
+	int        _nthreads;
+	int        _nrunning;
+	int        _nchan;
+	int        _nslots;
+	int        _region;
+	sf_count_t _frames;
+	sf_count_t _start;
+	sf_count_t _nregions; /* set before the decoders start */
+
+	Worker* _workers;
+	Slot*   _slots;
+
+	/* protected by _lock */
+	sf_count_t _next;     /* next region to decode */
+	sf_count_t _consumed; /* regions released by the reader */
+	bool       _stop;
+
+	pthread_mutex_t _lock;
+	pthread_cond_t  _cond;
+
+	/* reader */
+	sf_count_t _rd_region;
+	sf_count_t _rd_pos;
+	bool       _rd_eof;
+	bool       _rd_error;
+};
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rendercache.h"
+
+RenderCache::RenderCache (void)
+	: _dir (0)
+	, _path (0)
+	, _tmp (0)
+	, _sf (0)
+{
+}
+
+RenderCache::~RenderCache (void)
+{
+	abort ();
+	free (_dir);
+	free (_path);
+}
+
+void
+RenderCache::init (const char* dir)
+{
+	free (_dir);
+	_dir = strdup (dir);
+	_key.init (Checksum::XXH64);
+}
+
+void
+RenderCache::add_key (void const* data, size_t len)
+{
+	_key.update (data, len);
+}
+
+bool
+RenderCache::add_file (const char* path)
+{
+	FILE* f = fopen (path, "rb");
+	if (!f) {
+		return false;
+	}
+	char   buf[65536];
+	size_t n;
+	while ((n = fread (buf, 1, sizeof (buf), f)) > 0) {
+		_key.update (buf, n);
+	}
+	bool ok = !ferror (f);
+	fclose (f);
+	return ok;
+}
+
+void
+RenderCache::make_path ()
+{
+	char hex[17];
+	free (_path);
+	_path = (char*)malloc (strlen (_dir) + 24);
+	sprintf (_path, "%s/%s.caf", _dir, _key.hex (hex));
+}
+
+SNDFILE*
+RenderCache::lookup (SF_INFO* nfo)
+{
+	if (!_dir) {
+		return 0;
+	}
+
+	make_path ();
+
+	SF_INFO  ci;
+	SNDFILE* sf;
+
+	memset (&ci, 0, sizeof (SF_INFO));
+	if (access (_path, R_OK) || (sf = sf_open (_path, SFM_READ, &ci)) == 0) {
+		return 0;
+	}
+	if (ci.samplerate != nfo->samplerate || ci.channels != nfo->channels) {
+		sf_close (sf);
+		return 0;
+	}
+	return sf;
+}
+
+bool
+RenderCache::create (int samplerate, int nchan)
+{
+	if (!_dir) {
+		return false;
+	}
+
+	if (!_path) {
+		make_path ();
+	}
+
+	SF_INFO ci;
+	memset (&ci, 0, sizeof (SF_INFO));
+	ci.samplerate = samplerate;
+	ci.channels   = nchan;
+	ci.format     = SF_FORMAT_CAF | SF_FORMAT_FLOAT;
+
+	_tmp = (char*)malloc (strlen (_path) + 24);
+	sprintf (_tmp, "%s.%d.tmp", _path, (int)getpid ());
+
+	if ((_sf = sf_open (_tmp, SFM_WRITE, &ci)) == 0) {
+		free (_tmp);
+		_tmp = 0;
+		return false;
+	}
+	return true;
+}
+
+bool
+RenderCache::write (float const* buf, int nframes)
+{
+	if (!_sf) {
+		return true;
+	}
+	if (nframes != sf_writef_float (_sf, buf, nframes)) {
+		abort ();
+		return false;
+	}
+	return true;
+}
+
+bool
+RenderCache::commit ()
+{
+	if (!_sf) {
+		return false;
+	}
+
+	sf_close (_sf);
+	_sf = 0;
+
+	/* rename is atomic, concurrent renders of the same job are safe */
+	bool rv = 0 == rename (_tmp, _path);
+	if (!rv) {
+		unlink (_tmp);
+	}
+	free (_tmp);
+	_tmp = 0;
+	return rv;
+}
+
+void
+RenderCache::abort ()
+{
+	if (_sf) {
+		sf_close (_sf);
+		_sf = 0;
+	}
+	if (_tmp) {
+		unlink (_tmp);
+		free (_tmp);
+		_tmp = 0;
+	}
+}
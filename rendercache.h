@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RENDERCACHE_H
+#define _RENDERCACHE_H
+
+#include <sndfile.h>
+
+#include "checksum.h"
+
+/* Content addressed cache of rendered audio.
+ *
+ * The key is a hash of the processing parameters and the input file.
+ * Entries store the limiter output as 32-bit float, so that a cache hit
+ * produces an output file identical to a fresh render, regardless of
+ * output format.
+ */
+class RenderCache
+{
+public:
+	RenderCache (void);
+	~RenderCache (void);
+
+	void init (const char* dir);
+
+	bool
+	enabled () const
+	{
+		return _dir != 0;
+	}
+
+	/* add parameters, or the contents of the input file to the key */
+	void add_key (void const* data, size_t len);
+	bool add_file (const char* path);
+
+	/* open a cached render for reading, returns NULL on cache miss */
+	SNDFILE* lookup (SF_INFO* nfo);
+
+	/* start a new entry, and store a copy of all written audio */
+	bool create (int samplerate, int nchan);
+	bool write (float const* buf, int nframes);
+	bool commit ();
+	void abort ();
+
+	char const*
+	path () const
+	{
+		return _path;
+	}
+
+private:
+	void make_path ();
+
+	char*    _dir;
+	char*    _path;
+	char*    _tmp;
+	SNDFILE* _sf;
+	Checksum _key;
+};
+
+#endif
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shmring.h"
+
+static_assert (sizeof (std::atomic<uint32_t>) == sizeof (uint32_t), "futex word");
+
+/* shared (not private) futex, the ring may be mapped by different processes */
+static void
+futex_wait (std::atomic<uint32_t>* addr, uint32_t val, uint64_t timeout)
+{
+	struct timespec ts;
+	ts.tv_sec  = timeout / 1000000000ULL;
+	ts.tv_nsec = timeout % 1000000000ULL;
+	syscall (SYS_futex, (uint32_t*)addr, FUTEX_WAIT, val, timeout > 0 ? &ts : 0, 0, 0);
+}
+
+static void
+futex_wake (std::atomic<uint32_t>* addr)
+{
+	syscall (SYS_futex, (uint32_t*)addr, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+/* layout: Header, nblocks time-stamps, nblocks * block * nchan samples */
+static size_t
+ring_size (uint32_t nchan, uint32_t block, uint32_t nblocks)
+{
+	return sizeof (ShmRing::Header) + nblocks * sizeof (uint64_t) + (size_t)nblocks * block * nchan * sizeof (float);
+}
+
+/* nblocks is used as a mask, the ring must fit the address space */
+static bool
+valid_geometry (int rate, int nchan, int block, int nblocks)
+{
+	if (rate <= 0 || nchan <= 0 || block <= 0 || nblocks < 2 || (nblocks & (nblocks - 1))) {
+		return false;
+	}
+	return (size_t)nchan * block <= SIZE_MAX / 8 / nblocks;
+}
+
+ShmRing::ShmRing (void)
+	: _hdr (0)
+	, _size (0)
+	, _name (0)
+	, _owner (false)
+{
+}
+
+ShmRing::~ShmRing (void)
+{
+	close ();
+}
+
+bool
+ShmRing::create (const char* name, int rate, int nchan, int block, int nblocks)
+{
+	close ();
+
+	if (!valid_geometry (rate, nchan, block, nblocks)) {
+		return false;
+	}
+
+	size_t size = ring_size (nchan, block, nblocks);
+
+	shm_unlink (name);
+	int fd = shm_open (name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0) {
+		return false;
+	}
+	if (ftruncate (fd, size)) {
+		::close (fd);
+		shm_unlink (name);
+		return false;
+	}
+	void* p = mmap (0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close (fd);
+	if (p == MAP_FAILED) {
+		shm_unlink (name);
+		return false;
+	}
+
+	memset (p, 0, size);
+	_hdr          = (Header*)p;
+	_hdr->rate    = rate;
+	_hdr->nchan   = nchan;
+	_hdr->block   = block;
+	_hdr->nblocks = nblocks;
+	_hdr->version = RING_VERSION;
+	/* publish last, clients check the magic */
+	std::atomic_thread_fence (std::memory_order_release);
+	_hdr->magic = RING_MAGIC;
+
+	_size  = size;
+	_name  = strdup (name);
+	_owner = true;
+	return true;
+}
+
+bool
+ShmRing::open (const char* name)
+{
+	close ();
+
+	int fd = shm_open (name, O_RDWR, 0);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat (fd, &st) || (size_t)st.st_size < sizeof (Header)) {
+		::close (fd);
+		return false;
+	}
+
+	void* p = mmap (0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close (fd);
+	if (p == MAP_FAILED) {
+		return false;
+	}
+
+	Header* h = (Header*)p;
+	if (h->magic != RING_MAGIC || h->version != RING_VERSION || !valid_geometry (h->rate, h->nchan, h->block, h->nblocks)) {
+		munmap (p, st.st_size);
+		return false;
+	}
+	if ((size_t)st.st_size < ring_size (h->nchan, h->block, h->nblocks)) {
+		munmap (p, st.st_size);
+		return false;
+	}
+
+	_hdr   = h;
+	_size  = st.st_size;
+	_name  = strdup (name);
+	_owner = false;
+	return true;
+}
+
+void
+ShmRing::close ()
+{
+	if (_hdr) {
+		munmap (_hdr, _size);
+	}
+	if (_owner && _name) {
+		shm_unlink (_name);
+	}
+	free (_name);
+	_hdr   = 0;
+	_size  = 0;
+	_name  = 0;
+	_owner = false;
+}
+
+uint64_t*
+ShmRing::stamp (uint32_t i) const
+{
+	return &((uint64_t*)&_hdr[1])[i & (_hdr->nblocks - 1)];
+}
+
+float*
+ShmRing::slot (uint32_t i) const
+{
+	float* data = (float*)&((uint64_t*)&_hdr[1])[_hdr->nblocks];
+	return &data[(size_t)(i & (_hdr->nblocks - 1)) * _hdr->block * _hdr->nchan];
+}
+
+float*
+ShmRing::write_ptr ()
+{
+	uint32_t wr = _hdr->wr.load (std::memory_order_relaxed);
+	if (wr - _hdr->rd.load (std::memory_order_acquire) >= _hdr->nblocks) {
+		return 0;
+	}
+	return slot (wr);
+}
+
+void
+ShmRing::write_commit (uint64_t t)
+{
+	uint32_t wr = _hdr->wr.load (std::memory_order_relaxed);
+	*stamp (wr) = t;
+	_hdr->wr.store (wr + 1, std::memory_order_seq_cst);
+	wake (WAIT_PROCESS);
+}
+
+void
+ShmRing::write_finish ()
+{
+	_hdr->flags.fetch_or (WRITE_END);
+	futex_wake (&_hdr->flags);
+}
+
+float*
+ShmRing::process_ptr (uint64_t* t)
+{
+	uint32_t pr = _hdr->pr.load (std::memory_order_relaxed);
+	if (pr == _hdr->wr.load (std::memory_order_acquire)) {
+		return 0;
+	}
+	if (t) {
+		*t = *stamp (pr);
+	}
+	return slot (pr);
+}
+
+void
+ShmRing::process_commit ()
+{
+	uint32_t pr = _hdr->pr.load (std::memory_order_relaxed);
+	_hdr->pr.store (pr + 1, std::memory_order_seq_cst);
+	wake (WAIT_READ);
+}
+
+void
+ShmRing::process_finish ()
+{
+	_hdr->flags.fetch_or (PROCESS_END);
+	futex_wake (&_hdr->flags);
+}
+
+float const*
+ShmRing::read_ptr (uint64_t* t)
+{
+	uint32_t rd = _hdr->rd.load (std::memory_order_relaxed);
+	if (rd == _hdr->pr.load (std::memory_order_acquire)) {
+		return 0;
+	}
+	if (t) {
+		*t = *stamp (rd);
+	}
+	return slot (rd);
+}
+
+void
+ShmRing::read_commit ()
+{
+	uint32_t rd = _hdr->rd.load (std::memory_order_relaxed);
+	_hdr->rd.store (rd + 1, std::memory_order_seq_cst);
+	wake (WAIT_WRITE);
+}
+
+/* Waiters sleep on `flags`, and every event that can end a wait
+ * modifies it: the committer clears the flag it wakes, finishing sets
+ * an end flag. A waiter sets its flag and then re-checks the index,
+ * a committer stores the index and then tests the flag, both
+ * sequentially consistent, so one of them sees the other. When the
+ * flags change after the waiter read them, the futex does not sleep.
+ */
+bool
+ShmRing::wait (uint32_t flag, uint32_t end, uint64_t timeout)
+{
+	uint64_t until = timeout > 0 ? now () + timeout : 0;
+	while (true) {
+		if (ready (flag)) {
+			return true;
+		}
+		uint32_t f = _hdr->flags.fetch_or (flag) | flag;
+		if (ready (flag)) {
+			return true;
+		}
+		if (f & end) {
+			return false;
+		}
+		uint64_t t = 0;
+		if (until > 0) {
+			uint64_t n = now ();
+			if (n >= until) {
+				return false;
+			}
+			t = until - n;
+		}
+		futex_wait (&_hdr->flags, f, t);
+	}
+}
+
+void
+ShmRing::wake (uint32_t flag)
+{
+	if (_hdr->flags.load () & flag) {
+		_hdr->flags.fetch_and (~flag);
+		futex_wake (&_hdr->flags);
+	}
+}
+
+bool
+ShmRing::ready (uint32_t flag) const
+{
+	switch (flag) {
+		case WAIT_WRITE:
+			return _hdr->wr.load () - _hdr->rd.load () < _hdr->nblocks;
+		case WAIT_PROCESS:
+			return _hdr->pr.load () != _hdr->wr.load ();
+		default:
+			return _hdr->rd.load () != _hdr->pr.load ();
+	}
+}
+
+bool
+ShmRing::wait_write (uint64_t timeout)
+{
+	return wait (WAIT_WRITE, 0, timeout);
+}
+
+bool
+ShmRing::wait_process (uint64_t timeout)
+{
+	return wait (WAIT_PROCESS, WRITE_END, timeout);
+}
+
+bool
+ShmRing::wait_read (uint64_t timeout)
+{
+	return wait (WAIT_READ, PROCESS_END, timeout);
+}
+
+bool
+ShmRing::process_arm (uint32_t* f)
+{
+	if (ready (WAIT_PROCESS)) {
+		return false;
+	}
+	/* still announced from the last wait, if no block was committed since */
+	*f = _hdr->flags.load ();
+	if (!(*f & WAIT_PROCESS)) {
+		*f = _hdr->flags.fetch_or (WAIT_PROCESS) | WAIT_PROCESS;
+	}
+	return !ready (WAIT_PROCESS);
+}
+
+uint64_t
+ShmRing::now ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
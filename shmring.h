@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SHMRING_H
+#define _SHMRING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Ring of fixed-size audio blocks in POSIX shared memory.
+ *
+ * Blocks pass three stages, each owned by one party and tracked by
+ * its own index: the producer writes at `wr`, the limiter processes
+ * in-place at `pr`, and the consumer reads at `rd`.
+ * Indices count blocks and wrap at 2^32, rd <= pr <= wr <= rd + nblocks.
+ *
+ * Each block carries the producer's CLOCK_MONOTONIC time-stamp, which
+ * the server uses for deadline accounting.
+ *
+ * A party that has nothing to do can block in wait_*(). It announces
+ * itself in `flags` and sleeps on that word using a shared futex, the
+ * commit of the preceding stage wakes it up. Commits only make a
+ * system call when someone is waiting. The producer, and after it the
+ * processor, mark the end of the stream with *_finish().
+ */
+class ShmRing
+{
+public:
+	enum {
+		RING_MAGIC   = 0x53474d52, /* "SGMR" */
+		RING_VERSION = 2
+	};
+
+	enum Flags {
+		WAIT_WRITE   = 0x01, /* producer waits for a free block */
+		WAIT_PROCESS = 0x02, /* processor waits for a written block */
+		WAIT_READ    = 0x04, /* consumer waits for a processed block */
+		WRITE_END    = 0x10, /* no more blocks will be written */
+		PROCESS_END  = 0x20  /* no more blocks will be processed */
+	};
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t rate;
+		uint32_t nchan;
+		uint32_t block;   /* frames per block */
+		uint32_t nblocks; /* capacity, power of two */
+
+		std::atomic<uint32_t> wr;
+		std::atomic<uint32_t> pr;
+		std::atomic<uint32_t> rd;
+
+		std::atomic<uint32_t> overruns; /* producer found the ring full */
+		std::atomic<uint32_t> missed;   /* blocks processed after their deadline */
+		std::atomic<uint32_t> flags;
+	};
+
+	ShmRing (void);
+	~ShmRing (void);
+
+	/* create and map a new ring, replacing an existing one of the same name */
+	bool create (const char* name, int rate, int nchan, int block, int nblocks);
+	/* map an existing ring */
+	bool open (const char* name);
+	/* unmap, and remove the segment if it was created by this instance */
+	void close ();
+
+	Header*
+	header () const
+	{
+		return _hdr;
+	}
+
+	int rate () const { return _hdr->rate; }
+	int nchan () const { return _hdr->nchan; }
+	int block () const { return _hdr->block; }
+
+	/* producer: free block or NULL if full; commit() publishes it */
+	float* write_ptr ();
+	void   write_commit (uint64_t stamp);
+	void   write_finish ();
+
+	/* processor: next written block or NULL */
+	float* process_ptr (uint64_t* stamp);
+	void   process_commit ();
+	void   process_finish ();
+
+	/* consumer: next processed block or NULL */
+	float const* read_ptr (uint64_t* stamp = 0);
+	void         read_commit ();
+
+	/* Block until the respective *_ptr () has a block, or until the
+	 * timeout in nanoseconds (0: none). Return false on timeout, or
+	 * when the preceding stage has finished and all its blocks have
+	 * been taken.
+	 */
+	bool wait_write (uint64_t timeout);
+	bool wait_process (uint64_t timeout);
+	bool wait_read (uint64_t timeout);
+
+	/* For a processor waiting on several rings at once: announce it,
+	 * like wait_process () does, and return true with the value of
+	 * futex () to sleep on, or false if a block is ready.
+	 */
+	bool process_arm (uint32_t* flags);
+
+	std::atomic<uint32_t>*
+	futex () const
+	{
+		return &_hdr->flags;
+	}
+
+	static uint64_t now ();
+
+private:
+	float*    slot (uint32_t i) const;
+	uint64_t* stamp (uint32_t i) const;
+
+	bool ready (uint32_t flag) const;
+	bool wait (uint32_t flag, uint32_t end, uint64_t timeout);
+	void wake (uint32_t flag);
+
+	Header* _hdr;
+	size_t  _size;
+	char*   _name;
+	bool    _owner;
+};
+
+#endif
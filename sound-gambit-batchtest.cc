@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "peaklim.h"
+#include "peaklim_batch.h"
+
+#define LANES 8
+
+/* Digital-peak must be identical to a mono Peaklim, true-peak may differ
+ * by rounding, the channel-major upsampler sums in a different order.
+ */
+static const float tp_tolerance = 1e-6f;
+
+struct Params {
+	float gain;
+	float threshold;
+	float release;
+	bool  true_peak;
+};
+
+/* parameters of a lane, they change half-way and true-peak toggles */
+static Params
+params (int l, bool second, bool true_peak)
+{
+	Params x;
+	if (!second) {
+		x.gain      = 2.f * l;
+		x.threshold = -1.f - 0.5f * l;
+		x.release   = 0.005f * (1 + l);
+		x.true_peak = true_peak && (l & 1);
+	} else {
+		x.gain      = 12.f - 1.5f * l;
+		x.threshold = -3.f + 0.25f * l;
+		x.release   = 0.1f / (1 + l);
+		x.true_peak = true_peak && !(l & 1);
+	}
+	return x;
+}
+
+static void
+configure (PeaklimBatch<LANES>& b, int l, Params const& x)
+{
+	b.set_inpgain (l, x.gain);
+	b.set_threshold (l, x.threshold);
+	b.set_release (l, x.release);
+	b.set_truepeak (l, x.true_peak);
+}
+
+static void
+configure (Peaklim& p, Params const& x)
+{
+	p.set_inpgain (x.gain);
+	p.set_threshold (x.threshold);
+	p.set_release (x.release);
+	p.set_truepeak (x.true_peak);
+}
+
+/* Process the input in the given blocks with PeaklimBatch and with
+ * one mono Peaklim per lane, returns the largest difference.
+ */
+static float
+compare (int rate, bool true_peak, float const* inp, float* out, float* mi, float* mo,
+         int len, int const* blocks, int nblocks)
+{
+	PeaklimBatch<LANES> b;
+	b.init (rate);
+	for (int l = 0; l < LANES; ++l) {
+		configure (b, l, params (l, false, true_peak));
+	}
+
+	int half = nblocks / 2;
+	for (int i = 0, k = 0; i < nblocks; k += blocks[i++]) {
+		if (i == half) {
+			for (int l = 0; l < LANES; ++l) {
+				configure (b, l, params (l, true, true_peak));
+			}
+		}
+		b.process (blocks[i], &inp[k * LANES], &out[k * LANES]);
+	}
+
+	float diff = 0;
+	for (int l = 0; l < LANES; ++l) {
+		Peaklim p;
+		p.init (rate, 1);
+		configure (p, params (l, false, true_peak));
+
+		for (int i = 0; i < len; ++i) {
+			mi[i] = inp[i * LANES + l];
+		}
+		for (int i = 0, k = 0; i < nblocks; k += blocks[i++]) {
+			if (i == half) {
+				configure (p, params (l, true, true_peak));
+			}
+			p.process (blocks[i], &mi[k], &mo[k]);
+		}
+		for (int i = 0; i < len; ++i) {
+			diff = fmaxf (diff, fabsf (mo[i] - out[i * LANES + l]));
+		}
+	}
+	return diff;
+}
+
+/* `duration` seconds in blocks of random size, a different signal per lane */
+static bool
+test (int rate, float duration)
+{
+	int    len    = rate * duration;
+	float* inp    = (float*)malloc (len * LANES * sizeof (float));
+	float* out    = (float*)malloc (len * LANES * sizeof (float));
+	float* mi     = (float*)malloc (len * sizeof (float));
+	float* mo     = (float*)malloc (len * sizeof (float));
+	int*   blocks = (int*)malloc (len * sizeof (int));
+
+	uint32_t rnd = 1;
+	for (int i = 0; i < len; ++i) {
+		for (int l = 0; l < LANES; ++l) {
+			rnd     = rnd * 1664525 + 1013904223;
+			float n = (rnd >> 9) / (float)(1 << 23) - .5f;
+			float a = ((i / (rate / (4 + l))) % 3) == 0 ? 1.5f : 0.4f;
+			float p = fmodf ((60.f + 35.f * l) * i / (float)rate, 1.f);
+
+			inp[i * LANES + l] = a * (0.8f * sinf (2.f * M_PI * p) + 0.3f * n);
+		}
+	}
+
+	int nblocks = 0;
+	for (int k = 0; k < len;) {
+		rnd   = rnd * 1664525 + 1013904223;
+		int n = 1 + (rnd >> 8) % 700;
+		n     = n < len - k ? n : len - k;
+		k += n;
+		blocks[nblocks++] = n;
+	}
+
+	float dp = compare (rate, false, inp, out, mi, mo, len, blocks, nblocks);
+	float tp = compare (rate, true, inp, out, mi, mo, len, blocks, nblocks);
+
+	bool ok = dp == 0 && tp <= tp_tolerance;
+	printf ("%6d  digital-peak max-diff %-12g true-peak max-diff %-12g %s\n",
+	        rate, dp, tp, ok ? "ok" : "FAIL");
+
+	free (inp);
+	free (out);
+	free (mi);
+	free (mo);
+	free (blocks);
+	return ok;
+}
+
+int
+main (int argc, char** argv)
+{
+	static const int rates[] = { 44100, 48000, 96000, 192000, 400000, 820000 };
+
+	float duration = argc > 1 ? atof (argv[1]) : 3;
+	bool  ok       = true;
+
+	if (duration <= 0) {
+		fprintf (stderr, "Usage: sound-gambit-batchtest [duration]\n");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < sizeof (rates) / sizeof (int); ++i) {
+		ok &= test (rates[i], duration);
+	}
+
+	printf ("%s\n", ok ? "PeaklimBatch matches Peaklim" : "PeaklimBatch differs from Peaklim");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <linux/magic.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sndfile.h>
+
+/* clang-format off */
+static const struct {
+	const char* ext;
+	int         format;
+} formats[] = {
+	{ "wav",  SF_FORMAT_WAV  | SF_FORMAT_PCM_16 },
+	{ "wav",  SF_FORMAT_WAV  | SF_FORMAT_PCM_24 },
+	{ "wav",  SF_FORMAT_WAV  | SF_FORMAT_FLOAT },
+	{ "aiff", SF_FORMAT_AIFF | SF_FORMAT_PCM_16 },
+	{ "flac", SF_FORMAT_FLAC | SF_FORMAT_PCM_16 },
+	{ "flac", SF_FORMAT_FLAC | SF_FORMAT_PCM_24 },
+};
+/* clang-format on */
+
+static const int rates[] = { 44100, 48000, 96000 };
+static const int chans[] = { 1, 2, 2, 6 };
+
+struct Corpus {
+	char*  dir;
+	int    nfiles;
+	char** inp;
+	char** out;
+	double seconds; /* total audio duration */
+	size_t bytes;
+};
+
+static double
+now ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/* signal with a 10 dB range, periodically driving the limiter hard */
+static void
+generate (float* buf, int64_t pos, int nframes, int nchan, int rate, uint32_t* rnd)
+{
+	for (int i = 0; i < nframes; ++i) {
+		int64_t k = pos + i;
+		float   a = ((k / (rate / 8)) % 3) == 0 ? 1.5f : 0.5f;
+		for (int c = 0; c < nchan; ++c) {
+			*rnd    = *rnd * 1664525 + 1013904223;
+			float n = (*rnd >> 9) / (float)(1 << 23) - .5f;
+			float p = fmodf ((80.f + 40.f * c) * k / (float)rate, 1.f);
+
+			buf[i * nchan + c] = a * (0.8f * sinf (2.f * M_PI * p) + 0.4f * n);
+		}
+	}
+}
+
+static bool
+write_file (const char* path, int format, int rate, int nchan, int64_t len)
+{
+	SF_INFO nfo;
+	memset (&nfo, 0, sizeof (nfo));
+	nfo.samplerate = rate;
+	nfo.channels   = nchan;
+	nfo.format     = format;
+
+	SNDFILE* sf = sf_open (path, SFM_WRITE, &nfo);
+	if (!sf) {
+		return false;
+	}
+
+	/* meta-data is copied by sound-gambit */
+	sf_set_string (sf, SF_STR_TITLE, "sound-gambit-bench-e2e");
+	sf_set_string (sf, SF_STR_ARTIST, "synthetic");
+	sf_set_string (sf, SF_STR_COMMENT, path);
+
+	const int block = 8192;
+	float*    buf   = (float*)malloc (block * nchan * sizeof (float));
+	uint32_t  rnd   = 1;
+	bool      ok    = true;
+
+	for (int64_t pos = 0; pos < len && ok; pos += block) {
+		int n = len - pos < block ? len - pos : block;
+		generate (buf, pos, n, nchan, rate, &rnd);
+		ok = sf_writef_float (sf, buf, n) == n;
+	}
+
+	free (buf);
+	sf_close (sf);
+	return ok;
+}
+
+static void
+remove_corpus (Corpus& c)
+{
+	for (int i = 0; i < c.nfiles; ++i) {
+		if (c.inp[i]) {
+			unlink (c.inp[i]);
+		}
+		if (c.out[i]) {
+			unlink (c.out[i]);
+		}
+		free (c.inp[i]);
+		free (c.out[i]);
+	}
+	if (c.dir) {
+		rmdir (c.dir);
+	}
+	free (c.inp);
+	free (c.out);
+	free (c.dir);
+}
+
+/* files of mixed format, rate, channel-count and duration */
+static bool
+create_corpus (Corpus& c, const char* parent, int nfiles, float duration)
+{
+	char tmpl[1024];
+	snprintf (tmpl, sizeof (tmpl), "%s/sound-gambit-e2e.XXXXXX", parent);
+
+	c.nfiles  = 0;
+	c.seconds = 0;
+	c.bytes   = 0;
+	c.inp     = (char**)calloc (nfiles, sizeof (char*));
+	c.out     = (char**)calloc (nfiles, sizeof (char*));
+	c.dir     = mkdtemp (tmpl) ? strdup (tmpl) : 0;
+
+	if (!c.dir) {
+		fprintf (stderr, "Cannot create directory in '%s'\n", parent);
+		return false;
+	}
+
+	int nformats = sizeof (formats) / sizeof (formats[0]);
+	int skipped  = 0;
+
+	for (int i = 0; i < nfiles; ++i) {
+		/* each property varies with a different period */
+		int   f    = i % nformats;
+		int   rate = rates[(i / 2) % 3];
+		int   nch  = chans[(i / 3) % 4];
+		float len  = duration * (1 + i % 5) / 5.f;
+
+		SF_INFO nfo;
+		memset (&nfo, 0, sizeof (nfo));
+		nfo.samplerate = rate;
+		nfo.channels   = nch;
+		nfo.format     = formats[f].format;
+		if (!sf_format_check (&nfo)) {
+			++skipped;
+			continue;
+		}
+
+		char path[1100];
+		snprintf (path, sizeof (path), "%s/in-%03d.%s", c.dir, i, formats[f].ext);
+		if (!write_file (path, formats[f].format, rate, nch, (int64_t)(len * rate))) {
+			fprintf (stderr, "Cannot write '%s'\n", path);
+			unlink (path);
+			return false;
+		}
+		c.inp[c.nfiles] = strdup (path);
+
+		snprintf (path, sizeof (path), "%s/out-%03d.%s", c.dir, i, formats[f].ext);
+		c.out[c.nfiles] = strdup (path);
+
+		struct stat st;
+		if (stat (c.inp[c.nfiles], &st) == 0) {
+			c.bytes += st.st_size;
+		}
+		c.seconds += (int64_t)(len * rate) / (double)rate;
+		++c.nfiles;
+	}
+
+	if (skipped > 0) {
+		fprintf (stderr, "Note: %d files skipped, format not supported by libsndfile\n", skipped);
+	}
+	return c.nfiles > 0;
+}
+
+/* process all files, using up to `jobs` concurrent processes */
+static bool
+run (Corpus const& c, int jobs, char** cmd, int cmdlen, double* wall, double* cpu)
+{
+	char** argv = (char**)calloc (cmdlen + 3, sizeof (char*));
+	memcpy (argv, cmd, cmdlen * sizeof (char*));
+
+	int  next    = 0;
+	int  running = 0;
+	bool ok      = true;
+
+	*cpu = 0;
+
+	double t0 = now ();
+
+	while (next < c.nfiles || running > 0) {
+		if (next < c.nfiles && running < jobs && ok) {
+			argv[cmdlen]     = c.inp[next];
+			argv[cmdlen + 1] = c.out[next];
+			pid_t pid        = fork ();
+			if (pid == 0) {
+				execvp (argv[0], argv);
+				fprintf (stderr, "Cannot execute '%s'\n", argv[0]);
+				_exit (127);
+			} else if (pid < 0) {
+				fprintf (stderr, "Cannot start '%s'\n", argv[0]);
+				ok = false;
+				continue;
+			}
+			++next;
+			++running;
+			continue;
+		}
+		if (running == 0) {
+			break;
+		}
+
+		int           status;
+		struct rusage ru;
+		if (wait4 (-1, &status, 0, &ru) < 0) {
+			ok = false;
+			break;
+		}
+		--running;
+		*cpu += ru.ru_utime.tv_sec + 1e-6 * ru.ru_utime.tv_usec;
+		*cpu += ru.ru_stime.tv_sec + 1e-6 * ru.ru_stime.tv_usec;
+		if (!WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+			ok = false;
+		}
+	}
+
+	*wall = now () - t0;
+
+	for (int i = 0; i < c.nfiles; ++i) {
+		unlink (c.out[i]);
+	}
+	free (argv);
+	return ok;
+}
+
+static void
+usage ()
+{
+	// help2man compatible format (standard GNU help-text)
+	printf ("sound-gambit-bench-e2e - Batch throughput of the complete command.\n\n");
+	printf ("Usage: sound-gambit-bench-e2e [ OPTIONS ] [ -- <command> ... ]\n\n");
+
+	/* **** "---------|---------|---------|---------|---------|---------|---------|---------|" */
+	printf ("Options:\n"
+	        "  -C, --directory <path>     where to create the corpus (default /dev/shm)\n"
+	        "  -d, --duration <sec>       longest file in the corpus (default 20)\n"
+	        "  -j, --jobs <list>          comma separated job counts (default 1,2,4..cores)\n"
+	        "  -n, --files <num>          number of files in the corpus (default 60)\n"
+	        "  -h, --help                 display this help and exit\n"
+	        "\n");
+
+	printf ("\n"
+	        "This utility generates a corpus of synthetic audio files of mixed\n"
+	        "format, sample-rate, channel-count and duration, and processes all\n"
+	        "of them with the given command (default ./sound-gambit), which is\n"
+	        "called with an input and output file appended to it. This includes\n"
+	        "the cost of opening, decoding, encoding and copying meta-data, which\n"
+	        "micro-benchmarks do not measure.\n"
+	        "\n"
+	        "The corpus is processed once for every job count, with as many\n"
+	        "concurrent processes. For each run, the files per second, the audio\n"
+	        "duration processed per wall-clock second (x-realtime), the CPU time\n"
+	        "and the scaling relative to the first job count are printed. The\n"
+	        "efficiency is the speedup divided by the job count ratio.\n"
+	        "\n"
+	        "The corpus should be on a tmpfs, so that storage does not limit the\n"
+	        "throughput. It is removed at exit.\n");
+
+	printf ("\n"
+	        "Examples:\n"
+	        "sound-gambit-bench-e2e -j 1,2,4,8 -- ./sound-gambit --auto-gain -i 3\n\n");
+
+	::exit (EXIT_SUCCESS);
+}
+
+int
+main (int argc, char** argv)
+{
+	const char* parent   = "/dev/shm";
+	const char* joblist  = 0;
+	float       duration = 20;
+	int         nfiles   = 60;
+
+	const char* optstring = "+C:d:hj:n:";
+
+	/* clang-format off */
+	const struct option longopts[] = {
+		{ "directory", required_argument, 0, 'C' },
+		{ "duration",  required_argument, 0, 'd' },
+		{ "help",      no_argument,       0, 'h' },
+		{ "jobs",      required_argument, 0, 'j' },
+		{ "files",     required_argument, 0, 'n' },
+		{ 0, 0, 0, 0 }
+	};
+	/* clang-format on */
+
+	int c = 0;
+	while (EOF != (c = getopt_long (argc, argv,
+	                                optstring, longopts, (int*)0))) {
+		switch (c) {
+			case 'C':
+				parent = optarg;
+				break;
+
+			case 'd':
+				duration = atof (optarg);
+				break;
+
+			case 'h':
+				usage ();
+				break;
+
+			case 'j':
+				joblist = optarg;
+				break;
+
+			case 'n':
+				nfiles = atoi (optarg);
+				break;
+
+			default:
+				fprintf (stderr, "Error: unrecognized option. See --help for usage information.\n");
+				::exit (EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if (duration <= 0 || nfiles < 1) {
+		fprintf (stderr, "Error: Invalid parameter. See --help for usage information.\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	/* job counts, default: powers of two and the number of cores */
+	int jobs[64];
+	int njobs = 0;
+	int cores = sysconf (_SC_NPROCESSORS_ONLN);
+
+	if (joblist) {
+		for (const char* p = joblist; *p && njobs < 64;) {
+			char* e;
+			long  j = strtol (p, &e, 10);
+			if (e == p || j < 1 || j > 1024 || (*e && *e != ',')) {
+				fprintf (stderr, "Error: Invalid job list '%s'.\n", joblist);
+				::exit (EXIT_FAILURE);
+			}
+			jobs[njobs++] = j;
+			p             = *e ? e + 1 : e;
+		}
+	} else {
+		for (int j = 1; j < cores && njobs < 63; j *= 2) {
+			jobs[njobs++] = j;
+		}
+		jobs[njobs++] = cores > 1 ? cores : 1;
+	}
+
+	static char  dflt[] = "./sound-gambit";
+	static char* dcmd[] = { dflt, 0 };
+
+	char** cmd    = optind < argc ? &argv[optind] : dcmd;
+	int    cmdlen = optind < argc ? argc - optind : 1;
+
+	struct statfs sfs;
+	if (statfs (parent, &sfs) == 0 && sfs.f_type != TMPFS_MAGIC) {
+		fprintf (stderr, "Note: '%s' is not a tmpfs, storage may limit the throughput\n", parent);
+	}
+
+	Corpus corpus;
+	memset (&corpus, 0, sizeof (corpus));
+
+	double t0 = now ();
+	if (!create_corpus (corpus, parent, nfiles, duration)) {
+		remove_corpus (corpus);
+		::exit (EXIT_FAILURE);
+	}
+
+	printf ("Corpus: %d files, %.1f s audio, %.1f MB, generated in %.1f s\n",
+	        corpus.nfiles, corpus.seconds, corpus.bytes / 1e6, now () - t0);
+	printf ("Command:");
+	for (int i = 0; i < cmdlen; ++i) {
+		printf (" %s", cmd[i]);
+	}
+	printf (" <in> <out>\nCores: %d\n\n", cores);
+
+	printf ("%5s %8s %9s %11s %8s %8s %10s\n",
+	        "jobs", "wall[s]", "files/s", "x-realtime", "cpu[s]", "speedup", "efficiency");
+
+	double base = 0;
+	int    rv   = 0;
+
+	for (int i = 0; i < njobs; ++i) {
+		double wall, cpu;
+		if (!run (corpus, jobs[i], cmd, cmdlen, &wall, &cpu)) {
+			fprintf (stderr, "Error: processing failed with %d jobs\n", jobs[i]);
+			rv = 1;
+			break;
+		}
+		if (i == 0) {
+			base = wall;
+		}
+		double speedup = base / wall;
+		printf ("%5d %8.2f %9.2f %11.1f %8.2f %8.2f %9.0f%%\n",
+		        jobs[i], wall, corpus.nfiles / wall, corpus.seconds / wall, cpu,
+		        speedup, 100. * speedup * jobs[0] / jobs[i]);
+		fflush (stdout);
+	}
+
+	remove_corpus (corpus);
+	return rv;
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+
+#include "peaklim.h"
+#include "peaklim_batch.h"
+
+/* signal with a 10 dB range, periodically driving the limiter hard */
+static void
+generate (float* buf, int nframes, int nchan, int rate)
+{
+	uint32_t rnd = 1;
+	for (int i = 0; i < nframes; ++i) {
+		float a = ((i / (rate / 8)) % 3) == 0 ? 1.5f : 0.5f;
+		for (int c = 0; c < nchan; ++c) {
+			rnd = rnd * 1664525 + 1013904223;
+			float n = (rnd >> 9) / (float)(1 << 23) - .5f;
+			buf[i * nchan + c] = a * (0.8f * sinf (2.f * M_PI * (80.f + 40.f * c) * i / rate) + 0.4f * n);
+		}
+	}
+}
+
+static void
+bench (int rate, int nchan, bool true_peak, int block, float duration)
+{
+	int    len = rate * duration;
+	float* inp = (float*)malloc (len * nchan * sizeof (float));
+	float* out = (float*)malloc (block * nchan * sizeof (float));
+
+	generate (inp, len, nchan, rate);
+
+	Peaklim p;
+	p.init (rate, nchan);
+	p.set_inpgain (6);
+	p.set_threshold (-1);
+	p.set_release (0.01);
+	p.set_truepeak (true_peak);
+
+	size_t bytes = p.get_size ();
+	p.set_timing (true);
+
+	for (int k = 0; k + block <= len; k += block) {
+		p.process (block, &inp[k * nchan], out);
+	}
+
+	LatencyHist const* t = p.get_timing ();
+
+	printf ("%6d %3d %-4s %6zu %6d %9.1f %8.2f %8.2f %8.2f %8.2f\n",
+	        rate, nchan, true_peak ? "dBTP" : "dBFS", bytes, block,
+	        1e6 * block / rate,
+	        t->percentile (50) / 1e3, t->percentile (99) / 1e3,
+	        t->percentile (99.9) / 1e3, t->max () / 1e3);
+
+	free (inp);
+	free (out);
+}
+
+/* PeaklimBatch<8> against 8 mono Peaklim instances, same signals */
+static void
+bench_batch (int rate, bool true_peak, int block, float duration)
+{
+	enum { N = 8 };
+
+	int    len = rate * duration;
+	float* inp = (float*)malloc (len * N * sizeof (float));
+	float* out = (float*)malloc (block * N * sizeof (float));
+	float* mi  = (float*)malloc (len * sizeof (float));
+	float* mo  = (float*)malloc (block * sizeof (float));
+
+	generate (inp, len, N, rate);
+
+	PeaklimBatch<N> b;
+	Peaklim         p[N];
+	b.init (rate);
+	for (int l = 0; l < N; ++l) {
+		b.set_inpgain (l, 6);
+		b.set_threshold (l, -1);
+		b.set_release (l, 0.01);
+		b.set_truepeak (l, true_peak);
+		p[l].init (rate, 1);
+		p[l].set_inpgain (6);
+		p[l].set_threshold (-1);
+		p[l].set_release (0.01);
+		p[l].set_truepeak (true_peak);
+	}
+
+	LatencyHist tb, tm;
+	for (int k = 0; k + block <= len; k += block) {
+		uint64_t t0 = LatencyHist::now ();
+		b.process (block, &inp[k * N], out);
+		tb.record (LatencyHist::now () - t0);
+	}
+
+	/* time of all mono instances per block, one stream at a time */
+	int       nblocks = len / block;
+	uint64_t* per     = (uint64_t*)calloc (nblocks, sizeof (uint64_t));
+	for (int l = 0; l < N; ++l) {
+		for (int i = 0; i < len; ++i) {
+			mi[i] = inp[i * N + l];
+		}
+		for (int k = 0; k + block <= len; k += block) {
+			uint64_t t0 = LatencyHist::now ();
+			p[l].process (block, &mi[k], mo);
+			per[k / block] += LatencyHist::now () - t0;
+		}
+	}
+	for (int i = 0; i < nblocks; ++i) {
+		tm.record (per[i]);
+	}
+
+	printf ("%6d %-4s %6d %8.2f %8.2f %8.2f %8.2f %7.2fx\n",
+	        rate, true_peak ? "dBTP" : "dBFS", block,
+	        tm.percentile (50) / 1e3, tm.percentile (99) / 1e3,
+	        tb.percentile (50) / 1e3, tb.percentile (99) / 1e3,
+	        tm.percentile (50) / (double)tb.percentile (50));
+
+	free (per);
+	free (inp);
+	free (out);
+	free (mi);
+	free (mo);
+}
+
+static void
+usage ()
+{
+	// help2man compatible format (standard GNU help-text)
+	printf ("sound-gambit-bench - Peak Limiter processing-time statistics.\n\n");
+	printf ("Usage: sound-gambit-bench [ OPTIONS ]\n\n");
+
+	/* **** "---------|---------|---------|---------|---------|---------|---------|---------|" */
+	printf ("Options:\n"
+	        "  -B, --batch                compare PeaklimBatch<8> to 8 mono instances\n"
+	        "  -b, --blocksize <frames>   only test the given block size\n"
+	        "  -c, --channels <num>       only test the given channel count\n"
+	        "  -d, --duration <sec>       audio duration per configuration (default 10)\n"
+	        "  -s, --samplerate <hz>      only test the given sample-rate\n"
+	        "  -T, --true-peak            only test true-peak mode\n"
+	        "  -D, --digital-peak         only test digital-peak mode\n"
+	        "  -h, --help                 display this help and exit\n"
+	        "\n");
+
+	printf ("\n"
+	        "This utility measures the time of each Peaklim::process() call for\n"
+	        "a set of configurations, and prints the 50th, 99th and 99.9th\n"
+	        "percentile and the maximum in microseconds, along with the real-time\n"
+	        "budget of one block. The bytes column is the memory used by one\n"
+	        "limiter instance, excluding the timing statistics.\n"
+	        "\n"
+	        "With --batch, 8 independent mono streams are processed by one\n"
+	        "PeaklimBatch<8> and by 8 Peaklim instances. The 50th and 99th\n"
+	        "percentile of the time per block of all streams is printed for both,\n"
+	        "and the speedup at the median.\n");
+
+	::exit (EXIT_SUCCESS);
+}
+
+int
+main (int argc, char** argv)
+{
+	static const int rates[]  = { 44100, 48000, 96000, 192000 };
+	static const int chans[]  = { 1, 2, 8 };
+	static const int blocks[] = { 32, 64, 128, 256 };
+
+	float duration = 10;
+	int   rate     = 0;
+	int   nchan    = 0;
+	int   block    = 0;
+	int   modes    = 3; /* 1: digital, 2: true-peak */
+	bool  batch    = false;
+
+	const char* optstring = "Bb:c:Dd:hs:T";
+
+	/* clang-format off */
+	const struct option longopts[] = {
+		{ "batch",        no_argument,       0, 'B' },
+		{ "blocksize",    required_argument, 0, 'b' },
+		{ "channels",     required_argument, 0, 'c' },
+		{ "digital-peak", no_argument,       0, 'D' },
+		{ "duration",     required_argument, 0, 'd' },
+		{ "help",         no_argument,       0, 'h' },
+		{ "samplerate",   required_argument, 0, 's' },
+		{ "true-peak",    no_argument,       0, 'T' },
+		{ 0, 0, 0, 0 }
+	};
+	/* clang-format on */
+
+	int c = 0;
+	while (EOF != (c = getopt_long (argc, argv,
+	                                optstring, longopts, (int*)0))) {
+		switch (c) {
+			case 'B':
+				batch = true;
+				break;
+
+			case 'b':
+				block = atoi (optarg);
+				break;
+
+			case 'c':
+				nchan = atoi (optarg);
+				break;
+
+			case 'D':
+				modes = 1;
+				break;
+
+			case 'd':
+				duration = atof (optarg);
+				break;
+
+			case 'h':
+				usage ();
+				break;
+
+			case 's':
+				rate = atoi (optarg);
+				break;
+
+			case 'T':
+				modes = 2;
+				break;
+
+			default:
+				fprintf (stderr, "Error: unrecognized option. See --help for usage information.\n");
+				::exit (EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if (duration <= 0 || (rate && rate < 8000) || nchan < 0 || block < 0) {
+		fprintf (stderr, "Error: Invalid parameter. See --help for usage information.\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (batch) {
+		printf ("%6s %-4s %6s %8s %8s %8s %8s %8s  [us]\n",
+		        "rate", "mode", "block", "mono p50", "p99", "batch50", "p99", "speedup");
+	} else {
+		printf ("%6s %3s %-4s %6s %6s %9s %8s %8s %8s %8s  [us]\n",
+		        "rate", "ch", "mode", "bytes", "block", "budget", "p50", "p99", "p99.9", "max");
+	}
+
+	/* given values replace the default set */
+	int const* rl = rate > 0 ? &rate : rates;
+	int const* cl = nchan > 0 ? &nchan : chans;
+	int const* bl = block > 0 ? &block : blocks;
+	int        nr = rate > 0 ? 1 : 4;
+	int        nc = nchan > 0 ? 1 : 3;
+	int        nb = block > 0 ? 1 : 4;
+
+	if (batch) {
+		for (int r = 0; r < nr; ++r) {
+			for (int m = 1; m <= 2; ++m) {
+				if (!(modes & m)) {
+					continue;
+				}
+				for (int b = 0; b < nb; ++b) {
+					bench_batch (rl[r], m == 2, bl[b], duration);
+				}
+			}
+		}
+		return 0;
+	}
+
+	for (int r = 0; r < nr; ++r) {
+		for (int n = 0; n < nc; ++n) {
+			for (int m = 1; m <= 2; ++m) {
+				if (!(modes & m)) {
+					continue;
+				}
+				for (int b = 0; b < nb; ++b) {
+					bench (rl[r], cl[n], m == 2, bl[b], duration);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
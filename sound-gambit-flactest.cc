@@ -0,0 +1,865 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "flacwriter.h"
+
+/* Round-trip test of FlacWriter: files are encoded with every bit depth,
+ * compression level and with and without threads, then decoded by the
+ * minimal decoder below, which is written from RFC 9639 and shares no
+ * code with the encoder. Samples, frame CRCs, STREAMINFO (sizes, length,
+ * MD5) and tags are compared, and the stereo modes and subframe types
+ * that were used are counted.
+ */
+
+/* ****************************************************************************
+ * MD5, RFC 1321
+ */
+
+class Md5
+{
+public:
+	Md5 ()
+	{
+		_h[0] = 0x67452301;
+		_h[1] = 0xefcdab89;
+		_h[2] = 0x98badcfe;
+		_h[3] = 0x10325476;
+		_len  = 0;
+		for (int i = 0; i < 64; ++i) {
+			_k[i] = (uint32_t)(fabs (sin (i + 1.0)) * 4294967296.0);
+		}
+	}
+
+	void
+	update (uint8_t b)
+	{
+		_buf[_len++ & 63] = b;
+		if ((_len & 63) == 0) {
+			block ();
+		}
+	}
+
+	void
+	digest (uint8_t* out)
+	{
+		uint64_t bits = _len * 8;
+		update (0x80);
+		while ((_len & 63) != 56) {
+			update (0);
+		}
+		for (int i = 0; i < 8; ++i) {
+			update (bits >> (8 * i));
+		}
+		for (int i = 0; i < 16; ++i) {
+			out[i] = _h[i / 4] >> (8 * (i % 4));
+		}
+	}
+
+private:
+	void
+	block ()
+	{
+		static const int r[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+		uint32_t m[16];
+		for (int i = 0; i < 16; ++i) {
+			m[i] = _buf[4 * i] | (_buf[4 * i + 1] << 8) | (_buf[4 * i + 2] << 16) | ((uint32_t)_buf[4 * i + 3] << 24);
+		}
+		uint32_t a = _h[0], b = _h[1], c = _h[2], d = _h[3];
+		for (int i = 0; i < 64; ++i) {
+			uint32_t f;
+			int      g;
+			switch (i / 16) {
+				case 0:
+					f = (b & c) | (~b & d);
+					g = i;
+					break;
+				case 1:
+					f = (d & b) | (~d & c);
+					g = (5 * i + 1) & 15;
+					break;
+				case 2:
+					f = b ^ c ^ d;
+					g = (3 * i + 5) & 15;
+					break;
+				default:
+					f = c ^ (b | ~d);
+					g = (7 * i) & 15;
+					break;
+			}
+			uint32_t t = a + f + _k[i] + m[g];
+			int      s = r[(i / 16) * 4 + (i & 3)];
+			a          = d;
+			d          = c;
+			c          = b;
+			b          = b + ((t << s) | (t >> (32 - s)));
+		}
+		_h[0] += a;
+		_h[1] += b;
+		_h[2] += c;
+		_h[3] += d;
+	}
+
+	uint32_t _h[4];
+	uint32_t _k[64];
+	uint64_t _len;
+	uint8_t  _buf[64];
+};
+
+/* ****************************************************************************
+ * Decoder
+ */
+
+class BitReader
+{
+public:
+	BitReader (uint8_t const* p, size_t len)
+		: _p (p)
+		, _len (len)
+		, _pos (0)
+		, _bit (0)
+		, _over (false)
+	{
+	}
+
+	/* n <= 32 bits, MSB first */
+	uint32_t
+	bits (int n)
+	{
+		uint64_t v = 0;
+		while (n > 0) {
+			if (_pos >= _len) {
+				_over = true;
+				return 0;
+			}
+			int avail = 8 - _bit;
+			int take  = n < avail ? n : avail;
+			v         = (v << take) | ((_p[_pos] >> (avail - take)) & ((1 << take) - 1));
+			n -= take;
+			_bit += take;
+			if (_bit == 8) {
+				_bit = 0;
+				++_pos;
+			}
+		}
+		return v;
+	}
+
+	int32_t
+	sbits (int n)
+	{
+		uint32_t v = bits (n);
+		return n < 32 && (v >> (n - 1)) ? (int32_t)(v - (1u << n)) : (int32_t)v;
+	}
+
+	/* number of zeros before the next one */
+	uint32_t
+	unary ()
+	{
+		uint32_t n = 0;
+		while (!_over && bits (1) == 0) {
+			++n;
+		}
+		return n;
+	}
+
+	void
+	align ()
+	{
+		if (_bit) {
+			_bit = 0;
+			++_pos;
+		}
+	}
+
+	size_t pos () const { return _pos; }
+	bool   over () const { return _over; }
+
+private:
+	uint8_t const* _p;
+	size_t         _len;
+	size_t         _pos;
+	int            _bit;
+	bool           _over;
+};
+
+static uint8_t
+crc8 (uint8_t const* p, size_t n)
+{
+	uint8_t c = 0;
+	while (n--) {
+		c ^= *p++;
+		for (int b = 0; b < 8; ++b) {
+			c = (c & 0x80) ? (c << 1) ^ 0x07 : c << 1;
+		}
+	}
+	return c;
+}
+
+static uint16_t
+crc16 (uint8_t const* p, size_t n)
+{
+	uint16_t c = 0;
+	while (n--) {
+		c ^= *p++ << 8;
+		for (int b = 0; b < 8; ++b) {
+			c = (c & 0x8000) ? (c << 1) ^ 0x8005 : c << 1;
+		}
+	}
+	return c;
+}
+
+struct Decoded {
+	/* STREAMINFO */
+	int      min_bs, max_bs;
+	uint32_t min_fs, max_fs;
+	int      rate;
+	int      nchan;
+	int      bps;
+	uint64_t total;
+	uint8_t  md5[16];
+
+	char*  tags; /* VORBIS_COMMENT block */
+	size_t tags_len;
+
+	/* from the frames */
+	int32_t* smp; /* interleaved, `capacity` frames */
+	uint64_t capacity;
+	uint64_t frames;
+	uint32_t frame_min, frame_max;
+	int      assign[16];  /* frames per channel assignment */
+	int      subframe[4]; /* constant, verbatim, fixed, LPC */
+};
+
+static char const*
+decode_residual (BitReader& br, int32_t* x, int n, int order)
+{
+	int method = br.bits (2);
+	if (method > 1) {
+		return "reserved residual coding method";
+	}
+	int porder = br.bits (4);
+	if ((n >> porder) << porder != n || (n >> porder) < order) {
+		return "invalid partition order";
+	}
+	int i = order;
+	for (int p = 0; p < (1 << porder); ++p) {
+		int k   = br.bits (method ? 5 : 4);
+		int end = (p + 1) * (n >> porder);
+		if (k == (method ? 31 : 15)) {
+			int nb = br.bits (5);
+			for (; i < end; ++i) {
+				x[i] = nb ? br.sbits (nb) : 0;
+			}
+			continue;
+		}
+		for (; i < end; ++i) {
+			uint64_t u = ((uint64_t)br.unary () << k) | br.bits (k);
+			x[i]       = (int32_t)((u >> 1) ^ -(u & 1));
+		}
+	}
+	return 0;
+}
+
+static char const*
+decode_subframe (BitReader& br, int32_t* x, int n, int bps, Decoded* d)
+{
+	if (br.bits (1)) {
+		return "subframe padding";
+	}
+	int type   = br.bits (6);
+	int wasted = 0;
+	if (br.bits (1)) {
+		wasted = br.unary () + 1;
+		bps -= wasted;
+	}
+
+	if (type == 0) {
+		int32_t v = br.sbits (bps);
+		for (int i = 0; i < n; ++i) {
+			x[i] = v;
+		}
+		++d->subframe[0];
+	} else if (type == 1) {
+		for (int i = 0; i < n; ++i) {
+			x[i] = br.sbits (bps);
+		}
+		++d->subframe[1];
+	} else if (type >= 8 && type <= 12) {
+		int order = type - 8;
+		if (order > n) {
+			return "fixed order exceeds block size";
+		}
+		for (int i = 0; i < order; ++i) {
+			x[i] = br.sbits (bps);
+		}
+		char const* err = decode_residual (br, x, n, order);
+		if (err) {
+			return err;
+		}
+		static const int coef[5][4] = { { 0 }, { 1 }, { 2, -1 }, { 3, -3, 1 }, { 4, -6, 4, -1 } };
+		for (int i = order; i < n; ++i) {
+			int64_t p = 0;
+			for (int j = 0; j < order; ++j) {
+				p += (int64_t)coef[order][j] * x[i - j - 1];
+			}
+			x[i] += p;
+		}
+		++d->subframe[2];
+	} else if (type >= 32) {
+		int order = type - 31;
+		if (order > n) {
+			return "LPC order exceeds block size";
+		}
+		for (int i = 0; i < order; ++i) {
+			x[i] = br.sbits (bps);
+		}
+		int precision = br.bits (4) + 1;
+		int shift     = br.sbits (5);
+		if (precision == 16 || shift < 0) {
+			return "invalid LPC precision or shift";
+		}
+		int32_t q[32];
+		for (int i = 0; i < order; ++i) {
+			q[i] = br.sbits (precision);
+		}
+		char const* err = decode_residual (br, x, n, order);
+		if (err) {
+			return err;
+		}
+		for (int i = order; i < n; ++i) {
+			int64_t p = 0;
+			for (int j = 0; j < order; ++j) {
+				p += (int64_t)q[j] * x[i - j - 1];
+			}
+			x[i] += p >> shift;
+		}
+		++d->subframe[3];
+	} else {
+		return "reserved subframe type";
+	}
+
+	for (int i = 0; i < n; ++i) {
+		x[i] <<= wasted;
+	}
+	return 0;
+}
+
+static char const*
+decode_frame (uint8_t const* p, size_t len, uint64_t number, Decoded* d, int32_t* ch[8], size_t* used)
+{
+	static const int rates[12] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+	static const int sizes[8]  = { 0, 8, 12, 0, 16, 20, 24, 32 };
+
+	BitReader br (p, len);
+	if (br.bits (16) != 0xfff8) {
+		return "frame sync";
+	}
+	int bs_code   = br.bits (4);
+	int rate_code = br.bits (4);
+	int assign    = br.bits (4);
+	int size_code = br.bits (3);
+	if (br.bits (1) || assign > 10 || size_code == 3) {
+		return "reserved frame header value";
+	}
+
+	/* coded number, UTF-8 like */
+	uint64_t num  = br.bits (8);
+	int      more = 0;
+	while (more < 7 && (num & (0x80 >> more))) {
+		++more;
+	}
+	if (more == 1 || more == 7) {
+		return "coded number";
+	}
+	if (more > 1) {
+		num &= 0xff >> (more + 1);
+		for (int i = 1; i < more; ++i) {
+			num = (num << 6) | (br.bits (8) & 0x3f);
+		}
+	}
+	if (num != number) {
+		return "frame number";
+	}
+
+	int n = 0;
+	if (bs_code == 1) {
+		n = 192;
+	} else if (bs_code >= 2 && bs_code <= 5) {
+		n = 576 << (bs_code - 2);
+	} else if (bs_code == 6) {
+		n = br.bits (8) + 1;
+	} else if (bs_code == 7) {
+		n = br.bits (16) + 1;
+	} else if (bs_code >= 8) {
+		n = 256 << (bs_code - 8);
+	}
+
+	int rate = rate_code < 12 ? rates[rate_code] : 0;
+	if (rate_code == 12) {
+		rate = br.bits (8) * 1000;
+	} else if (rate_code == 13) {
+		rate = br.bits (16);
+	} else if (rate_code == 14) {
+		rate = br.bits (16) * 10;
+	}
+	if (rate_code == 0) {
+		rate = d->rate;
+	}
+
+	size_t hlen = br.pos ();
+	if (br.bits (8) != crc8 (p, hlen)) {
+		return "header CRC";
+	}
+
+	int nchan = assign < 8 ? assign + 1 : 2;
+	int bps   = size_code ? sizes[size_code] : d->bps;
+	if (n < 1 || n > d->max_bs || rate != d->rate || nchan != d->nchan || bps != d->bps) {
+		return "frame header does not match STREAMINFO";
+	}
+	if (d->frames + n > d->capacity) {
+		return "more frames than expected";
+	}
+
+	for (int c = 0; c < nchan; ++c) {
+		/* the side channel has one more bit */
+		bool side = (assign == 8 && c == 1) || (assign == 9 && c == 0) || (assign == 10 && c == 1);
+
+		char const* err = decode_subframe (br, ch[c], n, bps + side, d);
+		if (err) {
+			return err;
+		}
+	}
+
+	br.align ();
+	size_t flen = br.pos ();
+	if (br.bits (16) != crc16 (p, flen) || br.over ()) {
+		return "frame CRC";
+	}
+
+	int32_t* a = ch[0];
+	int32_t* b = ch[1];
+	for (int i = 0; i < n; ++i) {
+		switch (assign) {
+			case 8:
+				b[i] = a[i] - b[i];
+				break;
+			case 9:
+				a[i] = a[i] + b[i];
+				break;
+			case 10: {
+				int64_t m = ((int64_t)a[i] << 1) | (b[i] & 1);
+				a[i]      = (m + b[i]) >> 1;
+				b[i]      = (m - b[i]) >> 1;
+			} break;
+		}
+	}
+
+	int32_t vmax = (1 << (bps - 1)) - 1;
+	int32_t vmin = -(1 << (bps - 1));
+	for (int i = 0; i < n; ++i) {
+		for (int c = 0; c < nchan; ++c) {
+			int32_t v = ch[c][i];
+			if (v > vmax || v < vmin) {
+				return "sample out of range";
+			}
+			d->smp[(d->frames + i) * nchan + c] = v;
+		}
+	}
+
+	d->frames += n;
+	++d->assign[assign];
+	*used = br.pos ();
+	return 0;
+}
+
+/* decode a complete file, the caller allocates d->smp */
+static char const*
+decode (uint8_t const* p, size_t len, Decoded* d)
+{
+	if (len < 4 || memcmp (p, "fLaC", 4)) {
+		return "stream marker";
+	}
+	size_t pos  = 4;
+	bool   last = false;
+	bool   info = false;
+	while (!last) {
+		if (pos + 4 > len) {
+			return "truncated metadata";
+		}
+		last       = p[pos] & 0x80;
+		int    typ = p[pos] & 0x7f;
+		size_t bl  = (p[pos + 1] << 16) | (p[pos + 2] << 8) | p[pos + 3];
+		pos += 4;
+		if (pos + bl > len) {
+			return "truncated metadata";
+		}
+		if (typ == 0) {
+			if (bl != 34) {
+				return "STREAMINFO size";
+			}
+			BitReader br (&p[pos], bl);
+			d->min_bs = br.bits (16);
+			d->max_bs = br.bits (16);
+			d->min_fs = br.bits (24);
+			d->max_fs = br.bits (24);
+			d->rate   = br.bits (20);
+			d->nchan  = br.bits (3) + 1;
+			d->bps    = br.bits (5) + 1;
+			d->total  = (uint64_t)br.bits (4) << 32;
+			d->total |= br.bits (32);
+			for (int i = 0; i < 16; ++i) {
+				d->md5[i] = br.bits (8);
+			}
+			info = true;
+		} else if (typ == 4) {
+			d->tags     = (char*)&p[pos];
+			d->tags_len = bl;
+		}
+		pos += bl;
+	}
+	if (!info || d->max_bs < 16 || d->max_bs > 65535) {
+		return "no valid STREAMINFO";
+	}
+
+	int32_t* ch[8];
+	for (int c = 0; c < 8; ++c) {
+		ch[c] = (int32_t*)malloc (d->max_bs * sizeof (int32_t));
+	}
+
+	char const* err = 0;
+	for (uint64_t number = 0; pos < len && !err; ++number) {
+		size_t used;
+		err = decode_frame (&p[pos], len - pos, number, d, ch, &used);
+		if (!err) {
+			pos += used;
+			d->frame_min = used < d->frame_min ? used : d->frame_min;
+			d->frame_max = used > d->frame_max ? used : d->frame_max;
+		}
+	}
+
+	for (int c = 0; c < 8; ++c) {
+		free (ch[c]);
+	}
+	return err;
+}
+
+/* ****************************************************************************
+ * Test
+ */
+
+struct Case {
+	int  rate;
+	int  nchan;
+	int  bits;
+	int  level;
+	int  threads;
+	int  frames;
+	bool stereo_modes; /* a block for each stereo mode */
+};
+
+struct Count {
+	int assign[16];
+	int subframe[4];
+};
+
+static uint32_t rnd = 1;
+
+static float
+noise ()
+{
+	rnd = rnd * 1664525 + 1013904223;
+	return (rnd >> 9) / (float)(1 << 22) - 1.f;
+}
+
+static float
+tone (int i, int c, int rate)
+{
+	double t = i / (double)rate;
+	return 0.5 * sin (2 * M_PI * (220 + 30 * c) * t) + 0.2 * sin (2 * M_PI * (1375 + 11 * c) * t);
+}
+
+/* test signal, with blocks that favour each stereo decorrelation mode */
+static void
+generate (float* buf, Case const& tc)
+{
+	for (int i = 0; i < tc.frames; ++i) {
+		float* f = &buf[i * tc.nchan];
+		if (tc.nchan == 2 && tc.stereo_modes) {
+			float a = tone (i, 0, tc.rate);
+			float n = 0.01f * noise ();
+			switch ((i / FlacWriter::BLOCKSIZE) % 5) {
+				case 0: /* independent, one channel noise */
+					f[0] = noise ();
+					f[1] = a;
+					break;
+				case 1: /* left/side */
+					f[0] = a;
+					f[1] = a + n;
+					break;
+				case 2: /* right/side */
+					f[0] = a + n;
+					f[1] = a;
+					break;
+				case 3: /* mid/side */
+					f[0] = a + n;
+					f[1] = a - n;
+					break;
+				default: /* silence and clipping */
+					f[0] = 0;
+					f[1] = 2.f * a;
+					break;
+			}
+			continue;
+		}
+		for (int c = 0; c < tc.nchan; ++c) {
+			switch (c) {
+				case 2:
+					f[c] = 0.25f;
+					break;
+				case 3:
+					f[c] = noise ();
+					break;
+				default:
+					f[c] = tone (i, c, tc.rate) * (1.f + 0.5f * sinf (i * 1e-4f));
+					break;
+			}
+		}
+	}
+}
+
+static char const*
+check_tags (Decoded const& d, char const* title)
+{
+	char expect[64];
+	snprintf (expect, sizeof (expect), "TITLE=%s", title);
+	size_t len = strlen (expect);
+	for (size_t i = 0; d.tags && i + len <= d.tags_len; ++i) {
+		if (!memcmp (&d.tags[i], expect, len)) {
+			return 0;
+		}
+	}
+	return "tag not found";
+}
+
+static char const*
+run (Case const& tc, char const* path, Count* cnt)
+{
+	float*   buf = (float*)malloc (tc.frames * tc.nchan * sizeof (float));
+	int32_t* ref = (int32_t*)malloc (tc.frames * tc.nchan * sizeof (int32_t));
+	generate (buf, tc);
+
+	/* expected samples, as FlacWriter::write () converts them */
+	float const scale = (1 << (tc.bits - 1)) - 1;
+	int32_t     vmax  = (1 << (tc.bits - 1)) - 1;
+	int32_t     vmin  = -(1 << (tc.bits - 1));
+	for (int i = 0; i < tc.frames * tc.nchan; ++i) {
+		int32_t v = lrintf (buf[i] * scale);
+		ref[i]    = v > vmax ? vmax : v < vmin ? vmin : v;
+	}
+
+	char title[32];
+	snprintf (title, sizeof (title), "case-%d-%d-%d", tc.bits, tc.level, tc.frames);
+
+	FlacWriter fw;
+	if (!fw.open (path, tc.rate, tc.nchan, tc.bits, tc.level, tc.threads)) {
+		free (buf);
+		free (ref);
+		return "cannot open output";
+	}
+	fw.add_tag ("TITLE", title);
+
+	/* write in blocks of random size */
+	bool ok = true;
+	for (int i = 0; i < tc.frames && ok;) {
+		int n = 1 + (int)((noise () + 1.f) * 2500.f);
+		n     = n < tc.frames - i ? n : tc.frames - i;
+		ok    = fw.write (&buf[i * tc.nchan], n) == n;
+		i += n;
+	}
+	ok &= fw.close ();
+	free (buf);
+	if (!ok) {
+		free (ref);
+		return "write error";
+	}
+
+	FILE*    f   = fopen (path, "rb");
+	size_t   len = 0;
+	uint8_t* p   = 0;
+	if (f && !fseek (f, 0, SEEK_END)) {
+		len = ftell (f);
+		p   = (uint8_t*)malloc (len);
+		fseek (f, 0, SEEK_SET);
+		len = fread (p, 1, len, f);
+	}
+	if (f) {
+		fclose (f);
+	}
+
+	Decoded d;
+	memset (&d, 0, sizeof (d));
+	d.frame_min = UINT32_MAX;
+	d.capacity  = tc.frames;
+	d.smp       = (int32_t*)calloc ((size_t)tc.frames * tc.nchan, sizeof (int32_t));
+
+	char const* err = p ? decode (p, len, &d) : "cannot read output";
+
+	if (!err && (d.rate != tc.rate || d.nchan != tc.nchan || d.bps != tc.bits)) {
+		err = "STREAMINFO format";
+	}
+	if (!err && (d.total != (uint64_t)tc.frames || d.frames != d.total)) {
+		err = "length";
+	}
+	if (!err && (d.min_bs != FlacWriter::BLOCKSIZE || d.max_bs != FlacWriter::BLOCKSIZE)) {
+		err = "STREAMINFO block size";
+	}
+	if (!err && (d.min_fs != d.frame_min || d.max_fs != d.frame_max)) {
+		err = "STREAMINFO frame size";
+	}
+	if (!err && memcmp (d.smp, ref, (size_t)tc.frames * tc.nchan * sizeof (int32_t))) {
+		err = "samples differ";
+	}
+	if (!err) {
+		err = check_tags (d, title);
+	}
+	if (!err) {
+		Md5 md5;
+		for (int i = 0; i < tc.frames * tc.nchan; ++i) {
+			for (int b = 0; b < tc.bits / 8; ++b) {
+				md5.update (d.smp[i] >> (8 * b));
+			}
+		}
+		uint8_t digest[16];
+		md5.digest (digest);
+		if (memcmp (digest, d.md5, 16)) {
+			err = "MD5";
+		}
+	}
+
+	for (int i = 0; i < 16; ++i) {
+		cnt->assign[i] += d.assign[i];
+	}
+	for (int i = 0; i < 4; ++i) {
+		cnt->subframe[i] += d.subframe[i];
+	}
+
+	free (p);
+	free (ref);
+	free (d.smp);
+	return err;
+}
+
+int
+main ()
+{
+	static const int bits[]    = { 8, 16, 24 };
+	static const int threads[] = { 1, 4 };
+
+	/* rate, channels, frames: a short final block, exact blocks,
+	 * shorter than one block, and a single frame */
+	static const Case layouts[] = {
+		{ 48000, 2, 0, 0, 0, 5 * FlacWriter::BLOCKSIZE + 1234, true },
+		{ 44100, 1, 0, 0, 0, 3 * FlacWriter::BLOCKSIZE, false },
+		{ 50000, 6, 0, 0, 0, 2 * FlacWriter::BLOCKSIZE + 17, false },
+		{ 400000, 2, 0, 0, 0, 1000, false },
+		{ 12345, 1, 0, 0, 0, 1, false },
+	};
+
+	char path[64];
+	snprintf (path, sizeof (path), "/tmp/sound-gambit-flactest-%d.flac", (int)getpid ());
+
+	bool  ok = true;
+	Count total;
+	memset (&total, 0, sizeof (total));
+
+	for (int b = 0; b < 3; ++b) {
+		for (int level = 0; level <= 8; ++level) {
+			Count cnt;
+			memset (&cnt, 0, sizeof (cnt));
+			int files = 0;
+			int fail  = 0;
+
+			for (size_t l = 0; l < sizeof (layouts) / sizeof (Case); ++l) {
+				for (int t = 0; t < 2; ++t) {
+					Case tc    = layouts[l];
+					tc.bits    = bits[b];
+					tc.level   = level;
+					tc.threads = threads[t];
+
+					Count c;
+					memset (&c, 0, sizeof (c));
+					char const* err = run (tc, path, &c);
+					if (tc.stereo_modes && !err) {
+						/* levels 0 and 3 code channels independently, the others try all modes */
+						bool all = c.assign[1] && c.assign[8] && c.assign[9] && c.assign[10];
+						bool ind = c.assign[1] && !c.assign[8] && !c.assign[9] && !c.assign[10];
+						if (level == 0 || level == 3 ? !ind : !all) {
+							err = "stereo modes";
+						}
+					}
+					for (int i = 0; i < 16; ++i) {
+						cnt.assign[i] += c.assign[i];
+					}
+					for (int i = 0; i < 4; ++i) {
+						cnt.subframe[i] += c.subframe[i];
+					}
+					if (err) {
+						fprintf (stderr, "%2d-bit level %d, %d Hz, %d channels, %d frames, %d threads: %s\n",
+						         tc.bits, tc.level, tc.rate, tc.nchan, tc.frames, tc.threads, err);
+						++fail;
+					}
+					++files;
+				}
+			}
+
+			/* fixed predictors only up to level 2 */
+			if (level <= 2 && cnt.subframe[3] > 0) {
+				fprintf (stderr, "%2d-bit level %d: unexpected predictor type\n", bits[b], level);
+				++fail;
+			}
+
+			printf ("%2d-bit level %d  %2d files  L/R %3d L/S %3d R/S %3d M/S %3d  const %3d verbatim %3d fixed %4d lpc %4d  %s\n",
+			        bits[b], level, files,
+			        cnt.assign[1], cnt.assign[8], cnt.assign[9], cnt.assign[10],
+			        cnt.subframe[0], cnt.subframe[1], cnt.subframe[2], cnt.subframe[3],
+			        fail ? "FAIL" : "ok");
+
+			for (int i = 0; i < 4; ++i) {
+				total.subframe[i] += cnt.subframe[i];
+			}
+			ok &= fail == 0;
+		}
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		if (total.subframe[i] == 0) {
+			fprintf (stderr, "Subframe type %d was not used\n", i);
+			ok = false;
+		}
+	}
+
+	unlink (path);
+	printf ("%s\n", ok ? "FLAC round-trip ok" : "FLAC round-trip FAILED");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
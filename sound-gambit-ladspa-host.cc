@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <ladspa.h>
+#include <sndfile.h>
+
+#include "latencyhist.h"
+
+/* Count heap allocations while the plugin runs. The executable's
+ * definitions take precedence over the C library, also for the plugin.
+ */
+extern "C" void* __libc_malloc (size_t);
+extern "C" void* __libc_calloc (size_t, size_t);
+extern "C" void* __libc_realloc (void*, size_t);
+
+static bool     in_run = false;
+static uint64_t allocs = 0;
+
+extern "C" void*
+malloc (size_t n)
+{
+	if (in_run) {
+		++allocs;
+	}
+	return __libc_malloc (n);
+}
+
+extern "C" void*
+calloc (size_t n, size_t s)
+{
+	if (in_run) {
+		++allocs;
+	}
+	return __libc_calloc (n, s);
+}
+
+extern "C" void*
+realloc (void* p, size_t n)
+{
+	if (in_run) {
+		++allocs;
+	}
+	return __libc_realloc (p, n);
+}
+
+static void
+usage ()
+{
+	// help2man compatible format (standard GNU help-text)
+	printf ("sound-gambit-ladspa-host - Offline host for the LADSPA plugin.\n\n");
+	printf ("Usage: sound-gambit-ladspa-host [ OPTIONS ] <plugin.so> <src> <dst>\n\n");
+
+	/* **** "---------|---------|---------|---------|---------|---------|---------|---------|" */
+	printf ("Options:\n"
+	        "  -b, --blocksize <frames>   frames per run() call (default 1024)\n"
+	        "  -B, --vary                 vary the number of frames per call, 1..blocksize\n"
+	        "  -i, --input-gain <db>      input gain in dB (default 0)\n"
+	        "  -T, --true-peak            oversample, use true-peak threshold\n"
+	        "  -t, --threshold <dBFS>     threshold in dBFS/dBTP (default -1)\n"
+	        "  -r, --release-time <ms>    release-time in ms (default 10)\n"
+	        "  -h, --help                 display this help and exit\n"
+	        "\n");
+
+	printf ("\n"
+	        "This utility loads the plugin for the channel-count of the input\n"
+	        "file, processes the file as a real-time host would, and writes the\n"
+	        "result, compensating the latency that the plugin reports.\n"
+	        "\n"
+	        "Heap allocations during run() are counted. The time of each run()\n"
+	        "call is measured. The exit code is non-zero if the plugin allocates\n"
+	        "memory in run(), or if the output exceeds the threshold.\n");
+
+	printf ("\n"
+	        "Examples:\n"
+	        "sound-gambit-ladspa-host -B ./sound-gambit-ladspa.so in.wav out.wav\n\n");
+
+	::exit (EXIT_SUCCESS);
+}
+
+int
+main (int argc, char** argv)
+{
+	SF_INFO  nfo;
+	SNDFILE* infile    = NULL;
+	SNDFILE* outfile   = NULL;
+	void*    lib       = NULL;
+	int      block     = 1024;
+	bool     vary      = false;
+	bool     true_peak = false;
+	int      rv        = 0;
+
+	LADSPA_Data ctrl[5] = { 0, -1, 10, 0, 0 }; /* gain, threshold, release, true-peak, latency */
+
+	const char* optstring = "Bb:hi:r:Tt:";
+
+	/* clang-format off */
+	const struct option longopts[] = {
+		{ "blocksize",    required_argument, 0, 'b' },
+		{ "vary",         no_argument,       0, 'B' },
+		{ "help",         no_argument,       0, 'h' },
+		{ "input-gain",   required_argument, 0, 'i' },
+		{ "release-time", required_argument, 0, 'r' },
+		{ "true-peak",    no_argument,       0, 'T' },
+		{ "threshold",    required_argument, 0, 't' },
+		{ 0, 0, 0, 0 }
+	};
+	/* clang-format on */
+
+	int c = 0;
+	while (EOF != (c = getopt_long (argc, argv,
+	                                optstring, longopts, (int*)0))) {
+		switch (c) {
+			case 'b':
+				block = atoi (optarg);
+				break;
+
+			case 'B':
+				vary = true;
+				break;
+
+			case 'h':
+				usage ();
+				break;
+
+			case 'i':
+				ctrl[0] = atof (optarg);
+				break;
+
+			case 'r':
+				ctrl[2] = atof (optarg);
+				break;
+
+			case 'T':
+				true_peak = true;
+				ctrl[3]   = 1;
+				break;
+
+			case 't':
+				ctrl[1] = atof (optarg);
+				break;
+
+			default:
+				fprintf (stderr, "Error: unrecognized option. See --help for usage information.\n");
+				::exit (EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if (optind + 3 > argc) {
+		fprintf (stderr, "Error: Missing parameter. See --help for usage information.\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (block < 1) {
+		fprintf (stderr, "Error: Invalid block size.\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	lib = dlopen (argv[optind], RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		fprintf (stderr, "Cannot load plugin: %s\n", dlerror ());
+		::exit (EXIT_FAILURE);
+	}
+
+	LADSPA_Descriptor_Function ld = (LADSPA_Descriptor_Function)dlsym (lib, "ladspa_descriptor");
+	if (!ld) {
+		fprintf (stderr, "'%s' is not a LADSPA plugin\n", argv[optind]);
+		dlclose (lib);
+		::exit (EXIT_FAILURE);
+	}
+
+	memset (&nfo, 0, sizeof (SF_INFO));
+	if ((infile = sf_open (argv[optind + 1], SFM_READ, &nfo)) == 0) {
+		fprintf (stderr, "Cannot open '%s' for reading: ", argv[optind + 1]);
+		fputs (sf_strerror (NULL), stderr);
+		dlclose (lib);
+		::exit (EXIT_FAILURE);
+	}
+
+	/* find the plugin with matching audio inputs */
+	LADSPA_Descriptor const* d = NULL;
+	for (unsigned long i = 0; (d = ld (i)) != NULL; ++i) {
+		int n_in = 0;
+		for (unsigned long p = 0; p < d->PortCount; ++p) {
+			if (LADSPA_IS_PORT_AUDIO (d->PortDescriptors[p]) && LADSPA_IS_PORT_INPUT (d->PortDescriptors[p])) {
+				++n_in;
+			}
+		}
+		if (n_in == nfo.channels) {
+			break;
+		}
+	}
+
+	if (!d) {
+		fprintf (stderr, "No plugin for %d channels\n", nfo.channels);
+		sf_close (infile);
+		dlclose (lib);
+		::exit (EXIT_FAILURE);
+	}
+
+	if ((outfile = sf_open (argv[optind + 2], SFM_WRITE, &nfo)) == 0) {
+		fprintf (stderr, "Cannot open '%s' for writing: ", argv[optind + 2]);
+		fputs (sf_strerror (NULL), stderr);
+		sf_close (infile);
+		dlclose (lib);
+		::exit (EXIT_FAILURE);
+	}
+
+	int    nchan = nfo.channels;
+	float* inp   = (float*)malloc (block * nchan * sizeof (float));
+	float* out   = (float*)malloc (block * nchan * sizeof (float));
+	float* pin   = (float*)malloc (block * nchan * sizeof (float));
+	float* pout  = (float*)malloc (block * nchan * sizeof (float));
+
+	LADSPA_Handle h = d->instantiate (d, nfo.samplerate);
+
+	/* control ports in order, then audio inputs and outputs */
+	int ci = 0, ai = 0, ao = 0;
+	for (unsigned long p = 0; p < d->PortCount; ++p) {
+		LADSPA_PortDescriptor pd = d->PortDescriptors[p];
+		if (LADSPA_IS_PORT_CONTROL (pd)) {
+			d->connect_port (h, p, &ctrl[ci < 5 ? ci++ : 4]);
+		} else if (LADSPA_IS_PORT_INPUT (pd)) {
+			d->connect_port (h, p, &pin[block * ai++]);
+		} else {
+			d->connect_port (h, p, &pout[block * ao++]);
+		}
+	}
+
+	if (d->activate) {
+		d->activate (h);
+	}
+
+	LatencyHist timing;
+	float       peak    = 0;
+	int64_t     skip    = -1; /* latency, known after the first run () */
+	int64_t     flush   = 0;
+	bool        eof     = false;
+	uint32_t    rnd     = 1;
+	int64_t     written = 0;
+
+	while (true) {
+		int n = block;
+		if (vary) {
+			rnd = rnd * 1664525 + 1013904223;
+			n   = 1 + (rnd >> 8) % block;
+		}
+		if (!eof) {
+			n = sf_readf_float (infile, inp, n);
+			if (n <= 0) {
+				eof = true;
+			}
+		}
+		if (eof) {
+			/* feed silence to flush the latency */
+			if (skip < 0 || flush >= skip) {
+				break;
+			}
+			n = n < skip - flush ? n : skip - flush;
+			memset (inp, 0, n * nchan * sizeof (float));
+			flush += n;
+		}
+
+		for (int c = 0; c < nchan; ++c) {
+			for (int i = 0; i < n; ++i) {
+				pin[block * c + i] = inp[i * nchan + c];
+			}
+		}
+
+		uint64_t t0 = LatencyHist::now ();
+		in_run      = true;
+		d->run (h, n);
+		in_run = false;
+		timing.record (LatencyHist::now () - t0);
+
+		if (skip < 0) {
+			skip = ctrl[4];
+		}
+
+		/* discard the latency */
+		int off = 0;
+		if (written < skip) {
+			off = skip - written < n ? skip - written : n;
+		}
+		written += off;
+		for (int i = off; i < n; ++i) {
+			for (int c = 0; c < nchan; ++c) {
+				out[(i - off) * nchan + c] = pout[block * c + i];
+				peak = fmaxf (peak, fabsf (pout[block * c + i]));
+			}
+		}
+		if (n - off > 0 && n - off != sf_writef_float (outfile, out, n - off)) {
+			fprintf (stderr, "Error writing to output file.\n");
+			rv = 1;
+			break;
+		}
+		written += n - off;
+	}
+
+	if (d->deactivate) {
+		d->deactivate (h);
+	}
+	d->cleanup (h);
+
+	float peak_db = peak > 0 ? 20.f * log10f (peak) : -INFINITY;
+
+	printf ("Plugin          : %s (%lu)\n", d->Name, d->UniqueID);
+	printf ("Latency         : %d frames\n", (int)ctrl[4]);
+	printf ("Run calls       : %" PRIu64 ", p50 %.1f us, max %.1f us\n", timing.count (), timing.percentile (50) / 1e3, timing.max () / 1e3);
+	printf ("Allocations     : %" PRIu64 "\n", allocs);
+	printf ("Output peak     : %.2f dBFS\n", peak_db);
+
+	/* true-peak allows inter-sample overshoot of the digital peak */
+	if (allocs > 0 || (!true_peak && peak_db > ctrl[1] + 1e-3)) {
+		rv = 1;
+	}
+
+	sf_close (infile);
+	sf_close (outfile);
+	free (inp);
+	free (out);
+	free (pin);
+	free (pout);
+	dlclose (lib);
+	return rv;
+}
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ladspa.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peaklim.h"
+
+/* LADSPA plugin, mono and stereo.
+ *
+ * All memory is allocated in instantiate() and activate(), run() only
+ * updates changed parameters and processes the input in blocks of
+ * BLOCKSIZE frames, interleaved in a pre-allocated buffer.
+ */
+
+#define BLOCKSIZE 256 /* a multiple of Peaklim's chunk-size */
+
+#define SGL_UID 4340 /* mono, stereo is SGL_UID + 1 */
+
+enum {
+	P_INPGAIN = 0,
+	P_THRESHOLD,
+	P_RELEASE,
+	P_TRUEPEAK,
+	P_LATENCY,
+	P_AUDIO /* inputs, then outputs */
+};
+
+struct Plugin {
+	Peaklim p;
+	int     nchan;
+	float   rate;
+	float*  buf; /* interleaved, BLOCKSIZE * nchan */
+
+	LADSPA_Data* port[P_AUDIO + 4];
+
+	/* last applied parameters */
+	float inpgain;
+	float threshold;
+	float release;
+	bool  truepeak;
+};
+
+static LADSPA_Handle
+instantiate (const LADSPA_Descriptor* d, unsigned long rate)
+{
+	Plugin* self = new Plugin ();
+	self->nchan  = d->UniqueID == SGL_UID ? 1 : 2;
+	self->rate   = rate;
+	self->buf    = (float*)calloc (BLOCKSIZE * self->nchan, sizeof (float));
+	self->p.init (rate, self->nchan);
+	return self;
+}
+
+static void
+connect_port (LADSPA_Handle h, unsigned long port, LADSPA_Data* data)
+{
+	Plugin* self = (Plugin*)h;
+	if (port < P_AUDIO + 2 * (unsigned long)self->nchan) {
+		self->port[port] = data;
+	}
+}
+
+static float
+clamp (float v, float lo, float hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* parameters, only re-computed when changed */
+static void
+update (Plugin* self, bool force)
+{
+	float g = clamp (*self->port[P_INPGAIN], -10, 30);
+	float t = clamp (*self->port[P_THRESHOLD], -10, 0);
+	float r = clamp (*self->port[P_RELEASE], 1, 1000);
+	bool  T = *self->port[P_TRUEPEAK] > 0.5f;
+
+	if (force || g != self->inpgain) {
+		self->p.set_inpgain (g);
+		self->inpgain = g;
+	}
+	if (force || t != self->threshold) {
+		self->p.set_threshold (t);
+		self->threshold = t;
+	}
+	if (force || r != self->release) {
+		self->p.set_release (r / 1000.f);
+		self->release = r;
+	}
+	if (force || T != self->truepeak) {
+		self->p.set_truepeak (T);
+		self->truepeak = T;
+	}
+}
+
+static void
+activate (LADSPA_Handle h)
+{
+	Plugin* self = (Plugin*)h;
+	/* start from scratch */
+	self->p.fini ();
+	self->p.init (self->rate, self->nchan);
+	update (self, true);
+}
+
+static void
+run (LADSPA_Handle h, unsigned long n_samples)
+{
+	Plugin*             self  = (Plugin*)h;
+	int const           nchan = self->nchan;
+	float*              buf   = self->buf;
+	LADSPA_Data* const* inp   = &self->port[P_AUDIO];
+	LADSPA_Data* const* out   = &self->port[P_AUDIO + nchan];
+
+	update (self, false);
+
+	for (unsigned long k = 0; k < n_samples;) {
+		int n = n_samples - k > BLOCKSIZE ? BLOCKSIZE : n_samples - k;
+		for (int c = 0; c < nchan; ++c) {
+			for (int i = 0; i < n; ++i) {
+				buf[i * nchan + c] = inp[c][k + i];
+			}
+		}
+		self->p.process (n, buf, buf);
+		for (int c = 0; c < nchan; ++c) {
+			for (int i = 0; i < n; ++i) {
+				out[c][k + i] = buf[i * nchan + c];
+			}
+		}
+		k += n;
+	}
+
+	*self->port[P_LATENCY] = self->p.get_latency ();
+}
+
+static void
+cleanup (LADSPA_Handle h)
+{
+	Plugin* self = (Plugin*)h;
+	free (self->buf);
+	delete self;
+}
+
+/* ****************************************************************************
+ * Descriptors
+ */
+
+#define CTRL_IN LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL
+#define AUDIO_IN LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO
+#define AUDIO_OUT LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO
+
+/* clang-format off */
+static const LADSPA_PortDescriptor desc_mono[] = {
+	CTRL_IN, CTRL_IN, CTRL_IN, CTRL_IN, LADSPA_PORT_OUTPUT | LADSPA_PORT_CONTROL,
+	AUDIO_IN, AUDIO_OUT
+};
+
+static const LADSPA_PortDescriptor desc_stereo[] = {
+	CTRL_IN, CTRL_IN, CTRL_IN, CTRL_IN, LADSPA_PORT_OUTPUT | LADSPA_PORT_CONTROL,
+	AUDIO_IN, AUDIO_IN, AUDIO_OUT, AUDIO_OUT
+};
+
+static const char* const names_mono[] = {
+	"Input Gain (dB)", "Threshold (dBFS)", "Release (ms)", "True Peak", "latency",
+	"In", "Out"
+};
+
+static const char* const names_stereo[] = {
+	"Input Gain (dB)", "Threshold (dBFS)", "Release (ms)", "True Peak", "latency",
+	"In L", "In R", "Out L", "Out R"
+};
+/* clang-format on */
+
+/* LADSPA can not express the CLI's defaults of -1 dBFS and 10 ms,
+ * the nearest hints are -2.5 dBFS (high) and 5.6 ms (low, logarithmic).
+ */
+static const LADSPA_PortRangeHint hints[P_AUDIO + 4] = {
+	{ LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE | LADSPA_HINT_DEFAULT_0, -10, 30 },
+	{ LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE | LADSPA_HINT_DEFAULT_HIGH, -10, 0 },
+	{ LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE | LADSPA_HINT_LOGARITHMIC | LADSPA_HINT_DEFAULT_LOW, 1, 1000 },
+	{ LADSPA_HINT_TOGGLED | LADSPA_HINT_DEFAULT_0, 0, 0 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 },
+	{ 0, 0, 0 }
+};
+
+static const LADSPA_Descriptor descriptors[2] = {
+	{
+		SGL_UID,
+		"sound_gambit_mono",
+		LADSPA_PROPERTY_HARD_RT_CAPABLE,
+		"sound-gambit Peak Limiter (Mono)",
+		"Robin Gareus",
+		"GPL",
+		P_AUDIO + 2,
+		desc_mono,
+		names_mono,
+		hints,
+		0,
+		instantiate,
+		connect_port,
+		activate,
+		run,
+		0,
+		0,
+		0,
+		cleanup,
+	},
+	{
+		SGL_UID + 1,
+		"sound_gambit_stereo",
+		LADSPA_PROPERTY_HARD_RT_CAPABLE,
+		"sound-gambit Peak Limiter (Stereo)",
+		"Robin Gareus",
+		"GPL",
+		P_AUDIO + 4,
+		desc_stereo,
+		names_stereo,
+		hints,
+		0,
+		instantiate,
+		connect_port,
+		activate,
+		run,
+		0,
+		0,
+		0,
+		cleanup,
+	}
+};
+
+extern "C" __attribute__ ((visibility ("default"))) const LADSPA_Descriptor*
+ladspa_descriptor (unsigned long index)
+{
+	return index < 2 ? &descriptors[index] : 0;
+}
@@ -0,0 +1,773 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "peaklim.h"
+#include "shmring.h"
+
+/* futex_waitv (2) is Linux 5.16, older kernel headers lack it.
+ * Older kernels return ENOSYS, and the workers poll instead.
+ */
+#ifndef FUTEX_WAITV_MAX
+#define FUTEX_WAITV_MAX 128
+#define FUTEX_32 2
+struct futex_waitv {
+	uint64_t val;
+	uint64_t uaddr;
+	uint32_t flags;
+	uint32_t __reserved;
+};
+#endif
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+
+enum {
+	OPT_SYNTHETIC = 0x100,
+	OPT_DEADLINE,
+	OPT_RTPRIO,
+};
+
+struct Stream {
+	Stream ()
+	    : busy (false)
+	    , processed (0)
+	    , missed (0)
+	    , late_max (0)
+	{
+	}
+
+	ShmRing           ring;
+	Peaklim           lim;
+	std::atomic<bool> busy;
+
+	/* only modified by the worker holding `busy` */
+	uint64_t processed;
+	uint64_t missed;
+	uint64_t late_max;
+};
+
+struct Server;
+
+struct Worker {
+	Worker ()
+	    : srv (0)
+	    , id (0)
+	    , own (0)
+	    , n_own (0)
+	    , wv (0)
+	    , behind (false)
+	    , processed (0)
+	    , stolen (0)
+	{
+	}
+
+	~Worker ()
+	{
+		free (own);
+		free (wv);
+	}
+
+	Server*   srv;
+	int       id;
+	pthread_t thread;
+
+	Stream**            own; /* streams served by this worker */
+	int                 n_own;
+	struct futex_waitv* wv; /* FUTEX_WAITV_MAX entries */
+
+	/* more blocks of its own streams are ready than it processes */
+	std::atomic<bool> behind;
+
+	uint64_t processed;
+	uint64_t stolen;
+};
+
+struct Server {
+	Server ()
+	    : streams (0)
+	    , workers (0)
+	    , n_streams (8)
+	    , n_workers (0)
+	    , rate (48000)
+	    , nchan (2)
+	    , block (256)
+	    , queue (8)
+	    , deadline (0)
+	    , idle (0)
+	    , kick (0)
+	    , sleeping (0)
+	    , run (true)
+	{
+	}
+
+	Stream* streams;
+	Worker* workers;
+
+	int n_streams;
+	int n_workers;
+	int rate;
+	int nchan;
+	int block;
+	int queue;
+
+	uint64_t deadline; /* ns after the producer's time-stamp */
+	uint64_t idle;     /* poll interval, if a worker cannot wait for all its streams, ns */
+
+	std::atomic<uint32_t> kick;     /* futex, changed to wake idle workers */
+	std::atomic<int>      sleeping; /* workers looking for work or waiting */
+	std::atomic<bool>     run;
+};
+
+static Server* g_server = 0;
+
+static void
+catchsig (int)
+{
+	if (g_server) {
+		g_server->run = false;
+	}
+}
+
+static void
+sleep_ns (uint64_t ns)
+{
+	struct timespec ts;
+	ts.tv_sec  = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	nanosleep (&ts, 0);
+}
+
+/* wake up to `n` idle workers */
+static void
+kick_workers (Server* srv, int n)
+{
+	srv->kick.fetch_add (1);
+	syscall (SYS_futex, (uint32_t*)&srv->kick, FUTEX_WAKE_PRIVATE, n, 0, 0, 0);
+}
+
+/* earliest deadline first: find the stream with the oldest pending block
+ * in a worker's list, and count the streams that have a block ready.
+ */
+static Stream*
+pick (Stream* const* list, int n, int* ready)
+{
+	Stream*  best   = 0;
+	uint64_t best_t = UINT64_MAX;
+	int      cnt    = 0;
+	for (int i = 0; i < n; ++i) {
+		Stream*  s = list[i];
+		uint64_t t;
+		if (s->busy.load (std::memory_order_relaxed) || !s->ring.process_ptr (&t)) {
+			continue;
+		}
+		++cnt;
+		if (t < best_t) {
+			best   = s;
+			best_t = t;
+		}
+	}
+	*ready = cnt;
+	return best;
+}
+
+/* work stealing: the oldest block of the workers that are behind */
+static Stream*
+steal (Server* srv, Worker* w)
+{
+	Stream*  best   = 0;
+	uint64_t best_t = UINT64_MAX;
+	for (int i = 0; i < srv->n_workers; ++i) {
+		Worker* v = &srv->workers[i];
+		if (v == w || !v->behind.load ()) {
+			continue;
+		}
+		int      ready;
+		uint64_t t;
+		Stream*  s = pick (v->own, v->n_own, &ready);
+		if (s && s->ring.process_ptr (&t) && t < best_t) {
+			best   = s;
+			best_t = t;
+		}
+	}
+	return best;
+}
+
+/* Sleep until one of the worker's own streams has a block, or another
+ * worker falls behind. Only FUTEX_WAITV_MAX - 1 streams can be waited
+ * for at once, the remaining ones are polled every `srv->idle` ns.
+ */
+static void
+wait_work (Server* srv, Worker* w, uint32_t kick)
+{
+	int n = 0;
+	for (int i = 0; i < w->n_own && n < FUTEX_WAITV_MAX - 1; ++i) {
+		uint32_t f;
+		if (!w->own[i]->ring.process_arm (&f)) {
+			return;
+		}
+		w->wv[n].val        = f;
+		w->wv[n].uaddr      = (uintptr_t)w->own[i]->ring.futex ();
+		w->wv[n].flags      = FUTEX_32;
+		w->wv[n].__reserved = 0;
+		++n;
+	}
+	w->wv[n].val        = kick;
+	w->wv[n].uaddr      = (uintptr_t)&srv->kick;
+	w->wv[n].flags      = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+	w->wv[n].__reserved = 0;
+	++n;
+
+	struct timespec  ts;
+	struct timespec* timeout = 0;
+	if (n <= w->n_own) {
+		uint64_t until = ShmRing::now () + srv->idle;
+		ts.tv_sec      = until / 1000000000ULL;
+		ts.tv_nsec     = until % 1000000000ULL;
+		timeout        = &ts;
+	}
+
+	if (syscall (SYS_futex_waitv, w->wv, n, 0, timeout, CLOCK_MONOTONIC) < 0 && errno == ENOSYS) {
+		/* Linux < 5.16 */
+		sleep_ns (srv->idle);
+	}
+}
+
+static bool
+process_block (Server* srv, Stream* s)
+{
+	if (s->busy.exchange (true, std::memory_order_acquire)) {
+		return false;
+	}
+
+	uint64_t t;
+	float*   buf = s->ring.process_ptr (&t);
+	if (buf) {
+		s->lim.process (srv->block, buf, buf);
+		s->ring.process_commit ();
+
+		uint64_t done = ShmRing::now ();
+		if (done > t + srv->deadline) {
+			uint64_t late = done - t - srv->deadline;
+			if (late > s->late_max) {
+				s->late_max = late;
+			}
+			++s->missed;
+			s->ring.header ()->missed.fetch_add (1, std::memory_order_relaxed);
+		}
+		++s->processed;
+	}
+
+	s->busy.store (false, std::memory_order_release);
+	return buf != 0;
+}
+
+static void*
+worker (void* arg)
+{
+	Worker* w   = (Worker*)arg;
+	Server* srv = w->srv;
+
+	while (srv->run.load (std::memory_order_relaxed)) {
+		int     ready;
+		Stream* s = pick (w->own, w->n_own, &ready);
+
+		/* ask an idle worker for help, when more than the next block is ready */
+		bool behind = ready > 1;
+		if (behind != w->behind.load (std::memory_order_relaxed)) {
+			w->behind.store (behind);
+			if (behind && srv->sleeping.load () > 0) {
+				kick_workers (srv, 1);
+			}
+		}
+
+		bool stolen = false;
+		if (!s) {
+			/* announce first, then look: either this worker finds a
+			 * block of a worker that is behind, or that one kicks it
+			 */
+			uint32_t kick = srv->kick.load ();
+			srv->sleeping.fetch_add (1);
+			s = steal (srv, w);
+			if (!s && srv->run.load ()) {
+				wait_work (srv, w, kick);
+			}
+			srv->sleeping.fetch_sub (1);
+			if (!s) {
+				continue;
+			}
+			stolen = true;
+		}
+		if (process_block (srv, s)) {
+			++w->processed;
+			if (stolen) {
+				++w->stolen;
+			}
+		}
+	}
+	return 0;
+}
+
+/* synthetic producer: one block per stream and period, in real-time */
+static void*
+producer (void* arg)
+{
+	Server*  srv    = (Server*)arg;
+	uint64_t period = (uint64_t)srv->block * 1000000000ULL / srv->rate;
+	uint64_t pos    = 0;
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	while (srv->run.load (std::memory_order_relaxed)) {
+		uint64_t t = ShmRing::now ();
+		for (int i = 0; i < srv->n_streams; ++i) {
+			ShmRing* r = &srv->streams[i].ring;
+			float*   b = r->write_ptr ();
+			if (!b) {
+				r->header ()->overruns.fetch_add (1, std::memory_order_relaxed);
+				continue;
+			}
+			/* per stream sine, with 6 dB louder bursts */
+			double f = 2.0 * M_PI * (110.0 + 17.0 * i) / srv->rate;
+			for (int j = 0; j < srv->block; ++j) {
+				uint64_t n = pos + j;
+				float    a = ((n / (srv->rate / 4)) % 4) == 0 ? 1.4f : 0.7f;
+				float    x = a * sinf (f * (n % (uint64_t)srv->rate));
+				for (int c = 0; c < srv->nchan; ++c) {
+					b[j * srv->nchan + c] = x;
+				}
+			}
+			r->write_commit (t);
+		}
+		pos += srv->block;
+
+		ts.tv_nsec += period;
+		while (ts.tv_nsec >= 1000000000L) {
+			ts.tv_nsec -= 1000000000L;
+			++ts.tv_sec;
+		}
+		clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+	}
+	return 0;
+}
+
+/* synthetic consumer: discard processed blocks */
+static void*
+consumer (void* arg)
+{
+	Server*  srv    = (Server*)arg;
+	uint64_t period = (uint64_t)srv->block * 1000000000ULL / srv->rate;
+
+	while (srv->run.load (std::memory_order_relaxed)) {
+		for (int i = 0; i < srv->n_streams; ++i) {
+			ShmRing* r = &srv->streams[i].ring;
+			while (r->read_ptr ()) {
+				r->read_commit ();
+			}
+		}
+		sleep_ns (period / 2);
+	}
+	return 0;
+}
+
+static void
+report (Server* srv, FILE* f, int verbose)
+{
+	uint64_t processed = 0;
+	uint64_t missed    = 0;
+	uint64_t late_max  = 0;
+	uint64_t overruns  = 0;
+
+	for (int i = 0; i < srv->n_streams; ++i) {
+		Stream* s = &srv->streams[i];
+		processed += s->processed;
+		missed += s->missed;
+		overruns += s->ring.header ()->overruns.load ();
+		if (s->late_max > late_max) {
+			late_max = s->late_max;
+		}
+		if (verbose > 1) {
+			fprintf (f, "Stream %-8d : processed %" PRIu64 ", missed %" PRIu64 ", overruns %u\n",
+			         i, s->processed, s->missed, s->ring.header ()->overruns.load ());
+		}
+	}
+
+	fprintf (f, "Blocks processed: %" PRIu64 "\n", processed);
+	fprintf (f, "Missed deadline : %" PRIu64 " (%.3f%%)\n", missed, processed > 0 ? 100.0 * missed / processed : 0);
+	fprintf (f, "Max. lateness   : %.3f ms\n", late_max / 1e6);
+	fprintf (f, "Ring overruns   : %" PRIu64 "\n", overruns);
+
+	for (int i = 0; i < srv->n_workers; ++i) {
+		Worker* w = &srv->workers[i];
+		fprintf (f, "Worker %-8d : processed %" PRIu64 ", stolen %" PRIu64 "\n", i, w->processed, w->stolen);
+	}
+}
+
+static void
+usage ()
+{
+	// help2man compatible format (standard GNU help-text)
+	printf ("sound-gambit-server - Multi-stream real-time Peak Limiter.\n\n");
+	printf ("Usage: sound-gambit-server [ OPTIONS ]\n\n");
+
+	/* **** "---------|---------|---------|---------|---------|---------|---------|---------|" */
+	printf ("Options:\n"
+	        "  -n, --streams <num>        number of streams (default 8)\n"
+	        "  -c, --channels <num>       channels per stream (default 2)\n"
+	        "  -s, --samplerate <hz>      sample-rate (default 48000)\n"
+	        "  -b, --blocksize <frames>   frames per block (default 256)\n"
+	        "  -q, --queue <blocks>       ring-buffer size, power of two (default 8)\n"
+	        "  -w, --workers <num>        worker threads (default: number of CPUs)\n"
+	        "  -p, --prefix <name>        shared memory name prefix (default /sound-gambit)\n"
+	        "      --deadline <ms>        processing deadline (default: one block)\n"
+	        "      --rt-priority <prio>   run workers with SCHED_FIFO priority\n"
+	        "      --synthetic            generate and consume test signals\n"
+	        "  -d, --duration <sec>       run for given time (default: until interrupted)\n"
+	        "  -i, --input-gain <db>      input gain in dB (default 0)\n"
+	        "  -T, --true-peak            oversample, use true-peak threshold\n"
+	        "  -t, --threshold <dBFS>     threshold in dBFS/dBTP (default -1)\n"
+	        "  -r, --release-time <ms>    release-time in ms (default 10)\n"
+	        "  -h, --help                 display this help and exit\n"
+	        "  -v, --verbose              show per stream statistics\n"
+	        "  -V, --version              print version information and exit\n"
+	        "\n");
+
+	printf ("\n"
+	        "This utility hosts many independent limiter streams. Each stream is\n"
+	        "a ring-buffer of audio blocks in POSIX shared memory, named\n"
+	        "<prefix>-<index>, created by the server when it starts.\n"
+	        "\n"
+	        "A producer writes interleaved float blocks with a CLOCK_MONOTONIC\n"
+	        "time-stamp, the server limits them in-place, and a consumer reads\n"
+	        "them back. See shmring.h for the memory layout. The limiter adds\n"
+	        "a latency of about 1.2 ms to each stream.\n"
+	        "\n"
+	        "A fixed pool of workers processes ready blocks, oldest first. Each\n"
+	        "worker serves its own set of streams, and takes blocks from workers\n"
+	        "that have more than one block ready when it has nothing to do, or\n"
+	        "sleeps until one of its streams has a block. A stream is only\n"
+	        "processed by one worker at a time. Blocks that are completed later\n"
+	        "than the deadline after being written are counted as missed.\n"
+	        "\n"
+	        "With --synthetic, the server also runs a producer and a consumer for\n"
+	        "all streams, to test the load a given configuration can sustain.\n");
+
+	printf ("\n"
+	        "Examples:\n"
+	        "sound-gambit-server --synthetic -n 256 -c 1 -d 10\n\n");
+
+	printf ("Report bugs to <https://github.com/x42/sound-gambit/issues>\n"
+	        "Website: <https://github.com/x42/sound-gambit/>\n");
+	::exit (EXIT_SUCCESS);
+}
+
+int
+main (int argc, char** argv)
+{
+	Server srv;
+
+	float       input_gain   = 0;
+	float       threshold    = -1;
+	float       release_time = 0.01;
+	bool        true_peak    = false;
+	bool        synthetic    = false;
+	float       deadline_ms  = 0;
+	float       duration     = 0;
+	int         rt_prio      = 0;
+	int         verbose      = 0;
+	char const* prefix       = "/sound-gambit";
+	int         rv           = 0;
+
+	pthread_t prod, cons;
+
+	const char* optstring = "b:c:d:hi:n:p:q:r:s:Tt:Vvw:";
+
+	/* clang-format off */
+	const struct option longopts[] = {
+		{ "blocksize",    required_argument, 0, 'b' },
+		{ "channels",     required_argument, 0, 'c' },
+		{ "duration",     required_argument, 0, 'd' },
+		{ "help",         no_argument,       0, 'h' },
+		{ "input-gain",   required_argument, 0, 'i' },
+		{ "streams",      required_argument, 0, 'n' },
+		{ "prefix",       required_argument, 0, 'p' },
+		{ "queue",        required_argument, 0, 'q' },
+		{ "release-time", required_argument, 0, 'r' },
+		{ "samplerate",   required_argument, 0, 's' },
+		{ "true-peak",    no_argument,       0, 'T' },
+		{ "threshold",    required_argument, 0, 't' },
+		{ "version",      no_argument,       0, 'V' },
+		{ "verbose",      no_argument,       0, 'v' },
+		{ "workers",      required_argument, 0, 'w' },
+		{ "synthetic",    no_argument,       0, OPT_SYNTHETIC },
+		{ "deadline",     required_argument, 0, OPT_DEADLINE },
+		{ "rt-priority",  required_argument, 0, OPT_RTPRIO },
+		{ 0, 0, 0, 0 }
+	};
+	/* clang-format on */
+
+	int c = 0;
+	while (EOF != (c = getopt_long (argc, argv,
+	                                optstring, longopts, (int*)0))) {
+		switch (c) {
+			case 'b':
+				srv.block = atoi (optarg);
+				break;
+
+			case 'c':
+				srv.nchan = atoi (optarg);
+				break;
+
+			case 'd':
+				duration = atof (optarg);
+				break;
+
+			case 'h':
+				usage ();
+				break;
+
+			case 'i':
+				input_gain = atof (optarg);
+				break;
+
+			case 'n':
+				srv.n_streams = atoi (optarg);
+				break;
+
+			case 'p':
+				prefix = optarg;
+				break;
+
+			case 'q':
+				srv.queue = atoi (optarg);
+				break;
+
+			case 'r':
+				release_time = atof (optarg) / 1000.f;
+				break;
+
+			case 's':
+				srv.rate = atoi (optarg);
+				break;
+
+			case 'T':
+				true_peak = true;
+				break;
+
+			case 't':
+				threshold = atof (optarg);
+				break;
+
+			case 'V':
+				printf ("sound-gambit-server version %s\n\n", VERSION);
+				printf ("Copyright (C) GPL 2021 Robin Gareus <robin@gareus.org>\n");
+				exit (EXIT_SUCCESS);
+				break;
+
+			case 'v':
+				++verbose;
+				break;
+
+			case 'w':
+				srv.n_workers = atoi (optarg);
+				break;
+
+			case OPT_SYNTHETIC:
+				synthetic = true;
+				break;
+
+			case OPT_DEADLINE:
+				deadline_ms = atof (optarg);
+				break;
+
+			case OPT_RTPRIO:
+				rt_prio = atoi (optarg);
+				break;
+
+			default:
+				fprintf (stderr, "Error: unrecognized option. See --help for usage information.\n");
+				::exit (EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if (srv.n_workers <= 0) {
+		srv.n_workers = sysconf (_SC_NPROCESSORS_ONLN);
+		if (srv.n_workers <= 0) {
+			srv.n_workers = 1;
+		}
+	}
+
+	if (srv.n_streams < 1 || srv.nchan < 1 || srv.block < 1 || srv.rate < 8000) {
+		fprintf (stderr, "Error: Invalid stream configuration.\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (srv.queue < 2 || (srv.queue & (srv.queue - 1))) {
+		fprintf (stderr, "Error: Queue size must be a power of two (>= 2).\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (release_time < 0.001 || release_time > 1.0) {
+		fprintf (stderr, "Error: Release-time is out of bounds (1 <= r <= 1000) [ms].\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (threshold < -10 || threshold > 0) {
+		fprintf (stderr, "Error: Threshold is out of bounds (-10 <= t <= 0) [dBFS].\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (input_gain < -10 || input_gain > 30) {
+		fprintf (stderr, "Error: Input-gain is out of bounds (-10 <= t <= 30) [dB].\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	uint64_t period = (uint64_t)srv.block * 1000000000ULL / srv.rate;
+
+	srv.deadline = deadline_ms > 0 ? (uint64_t)(deadline_ms * 1e6) : period;
+	srv.idle     = period / 16 < 100000 ? period / 16 : 100000;
+
+	srv.streams = new Stream[srv.n_streams];
+	srv.workers = new Worker[srv.n_workers];
+
+	for (int i = 0; i < srv.n_workers; ++i) {
+		Worker* w = &srv.workers[i];
+		w->own    = (Stream**)malloc ((srv.n_streams / srv.n_workers + 1) * sizeof (Stream*));
+		w->wv     = (struct futex_waitv*)malloc (FUTEX_WAITV_MAX * sizeof (struct futex_waitv));
+		if (!w->own || !w->wv) {
+			fprintf (stderr, "Out of memory\n");
+			rv = 1;
+			goto end;
+		}
+	}
+	for (int i = 0; i < srv.n_streams; ++i) {
+		Worker* w          = &srv.workers[i % srv.n_workers];
+		w->own[w->n_own++] = &srv.streams[i];
+	}
+
+	for (int i = 0; i < srv.n_streams; ++i) {
+		Stream* s = &srv.streams[i];
+		char    name[256];
+		snprintf (name, sizeof (name), "%s-%d", prefix, i);
+		if (!s->ring.create (name, srv.rate, srv.nchan, srv.block, srv.queue)) {
+			fprintf (stderr, "Cannot create shared memory '%s'\n", name);
+			rv = 1;
+			goto end;
+		}
+		s->lim.init (srv.rate, srv.nchan);
+		s->lim.set_inpgain (input_gain);
+		s->lim.set_threshold (threshold);
+		s->lim.set_release (release_time);
+		s->lim.set_truepeak (true_peak);
+	}
+
+	g_server = &srv;
+	signal (SIGINT, catchsig);
+	signal (SIGTERM, catchsig);
+
+	for (int i = 0; i < srv.n_workers; ++i) {
+		Worker* w = &srv.workers[i];
+		w->srv    = &srv;
+		w->id     = i;
+		if (pthread_create (&w->thread, 0, worker, w)) {
+			fprintf (stderr, "Cannot start worker thread\n");
+			srv.run       = false;
+			srv.n_workers = i;
+			rv            = 1;
+			goto join;
+		}
+		if (rt_prio > 0) {
+			struct sched_param sp;
+			sp.sched_priority = rt_prio;
+			if (pthread_setschedparam (w->thread, SCHED_FIFO, &sp)) {
+				fprintf (stderr, "Cannot set real-time priority for worker %d\n", i);
+			}
+		}
+	}
+
+	if (synthetic) {
+		if (pthread_create (&prod, 0, producer, &srv)) {
+			fprintf (stderr, "Cannot start producer thread\n");
+			srv.run = false;
+			rv      = 1;
+			goto join;
+		}
+		if (pthread_create (&cons, 0, consumer, &srv)) {
+			fprintf (stderr, "Cannot start consumer thread\n");
+			srv.run = false;
+			rv      = 1;
+			pthread_join (prod, 0);
+			goto join;
+		}
+	}
+
+	if (verbose) {
+		printf ("Streams         : %d x %d channels, %d Hz\n", srv.n_streams, srv.nchan, srv.rate);
+		printf ("Block size      : %d frames (%.2f ms), queue %d\n", srv.block, period / 1e6, srv.queue);
+		printf ("Deadline        : %.2f ms\n", srv.deadline / 1e6);
+		printf ("Workers         : %d\n", srv.n_workers);
+	}
+
+	{
+		uint64_t start = ShmRing::now ();
+		while (srv.run.load ()) {
+			sleep_ns (10000000);
+			if (duration > 0 && ShmRing::now () - start >= duration * 1e9) {
+				srv.run = false;
+			}
+		}
+	}
+
+	if (synthetic) {
+		pthread_join (prod, 0);
+		pthread_join (cons, 0);
+	}
+
+join:
+	kick_workers (&srv, INT_MAX);
+	for (int i = 0; i < srv.n_workers; ++i) {
+		pthread_join (srv.workers[i].thread, 0);
+	}
+
+	if (rv == 0) {
+		report (&srv, stdout, verbose);
+	}
+
+end:
+	g_server = 0;
+	delete[] srv.streams;
+	delete[] srv.workers;
+	return rv;
+}
@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "latencyhist.h"
+#include "peaklim.h"
+#include "shmring.h"
+
+struct Test {
+	ShmRing           ring;
+	int               rate;
+	int               nchan;
+	int               block;
+	uint64_t          nblocks;
+	bool              realtime;
+	std::atomic<bool> error;
+};
+
+/* deterministic test signal, per channel sine with 6 dB louder bursts */
+static void
+generate (float* buf, uint64_t pos, int nframes, int nchan, int rate)
+{
+	for (int j = 0; j < nframes; ++j) {
+		uint64_t n = pos + j;
+		float    a = ((n / (rate / 4)) % 4) == 0 ? 1.4f : 0.7f;
+		for (int c = 0; c < nchan; ++c) {
+			double f = 2.0 * M_PI * (110.0 + 17.0 * c) / rate;
+			buf[j * nchan + c] = a * sinf (f * (n % (uint64_t)rate));
+		}
+	}
+}
+
+static void*
+producer (void* arg)
+{
+	Test*    t      = (Test*)arg;
+	uint64_t period = (uint64_t)t->block * 1000000000ULL / t->rate;
+
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	for (uint64_t i = 0; i < t->nblocks && !t->error; ++i) {
+		while (!t->ring.wait_write (100000000ULL)) {
+			if (t->error) {
+				return 0;
+			}
+		}
+		generate (t->ring.write_ptr (), i * t->block, t->block, t->nchan, t->rate);
+		t->ring.write_commit (ShmRing::now ());
+
+		if (t->realtime) {
+			ts.tv_nsec += period;
+			while (ts.tv_nsec >= 1000000000L) {
+				ts.tv_nsec -= 1000000000L;
+				++ts.tv_sec;
+			}
+			clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+		}
+	}
+	t->ring.write_finish ();
+	return 0;
+}
+
+static void
+usage ()
+{
+	// help2man compatible format (standard GNU help-text)
+	printf ("sound-gambit-shmtest - Shared-memory producer and consumer.\n\n");
+	printf ("Usage: sound-gambit-shmtest [ OPTIONS ] [ -- <command> ... ]\n\n");
+
+	/* **** "---------|---------|---------|---------|---------|---------|---------|---------|" */
+	printf ("Options:\n"
+	        "  -n, --name <name>          shared memory name (default /sound-gambit-shmtest)\n"
+	        "  -c, --channels <num>       channel count (default 2)\n"
+	        "  -s, --samplerate <hz>      sample-rate (default 48000)\n"
+	        "  -b, --blocksize <frames>   frames per block (default 256)\n"
+	        "  -q, --queue <blocks>       ring-buffer size, power of two (default 8)\n"
+	        "  -d, --duration <sec>       audio duration (default 10)\n"
+	        "  -R, --realtime             produce blocks in real-time\n"
+	        "  -i, --input-gain <db>      input gain of the limiter (default 0)\n"
+	        "  -T, --true-peak            the limiter uses true-peak\n"
+	        "  -t, --threshold <dBFS>     threshold of the limiter (default -1)\n"
+	        "  -r, --release-time <ms>    release-time of the limiter (default 10)\n"
+	        "  -h, --help                 display this help and exit\n"
+	        "\n");
+
+	printf ("\n"
+	        "This utility creates a shared-memory ring-buffer, writes a test signal\n"
+	        "to it and reads back the blocks processed by sound-gambit --shm.\n"
+	        "If a command is given, it is started once the ring exists.\n"
+	        "\n"
+	        "Each block is compared to the output of a local limiter, using the\n"
+	        "given parameters, which must match those of the tested process.\n"
+	        "The round-trip time from writing to reading a block, the throughput\n"
+	        "and the largest difference are printed. The exit code is non-zero\n"
+	        "if blocks are missing or differ.\n");
+
+	printf ("\n"
+	        "Examples:\n"
+	        "sound-gambit-shmtest -- sound-gambit --shm /sound-gambit-shmtest\n\n");
+
+	::exit (EXIT_SUCCESS);
+}
+
+int
+main (int argc, char** argv)
+{
+	Test t;
+
+	const char* name         = "/sound-gambit-shmtest";
+	int         queue        = 8;
+	float       duration     = 10;
+	float       input_gain   = 0;
+	float       threshold    = -1;
+	float       release_time = 0.01;
+	bool        true_peak    = false;
+	pid_t       pid          = 0;
+	int         rv           = 0;
+
+	t.rate     = 48000;
+	t.nchan    = 2;
+	t.block    = 256;
+	t.realtime = false;
+	t.error    = false;
+
+	const char* optstring = "+b:c:d:hi:n:q:Rr:s:Tt:";
+
+	/* clang-format off */
+	const struct option longopts[] = {
+		{ "blocksize",    required_argument, 0, 'b' },
+		{ "channels",     required_argument, 0, 'c' },
+		{ "duration",     required_argument, 0, 'd' },
+		{ "help",         no_argument,       0, 'h' },
+		{ "input-gain",   required_argument, 0, 'i' },
+		{ "name",         required_argument, 0, 'n' },
+		{ "queue",        required_argument, 0, 'q' },
+		{ "realtime",     no_argument,       0, 'R' },
+		{ "release-time", required_argument, 0, 'r' },
+		{ "samplerate",   required_argument, 0, 's' },
+		{ "true-peak",    no_argument,       0, 'T' },
+		{ "threshold",    required_argument, 0, 't' },
+		{ 0, 0, 0, 0 }
+	};
+	/* clang-format on */
+
+	int c = 0;
+	while (EOF != (c = getopt_long (argc, argv,
+	                                optstring, longopts, (int*)0))) {
+		switch (c) {
+			case 'b':
+				t.block = atoi (optarg);
+				break;
+
+			case 'c':
+				t.nchan = atoi (optarg);
+				break;
+
+			case 'd':
+				duration = atof (optarg);
+				break;
+
+			case 'h':
+				usage ();
+				break;
+
+			case 'i':
+				input_gain = atof (optarg);
+				break;
+
+			case 'n':
+				name = optarg;
+				break;
+
+			case 'q':
+				queue = atoi (optarg);
+				break;
+
+			case 'R':
+				t.realtime = true;
+				break;
+
+			case 'r':
+				release_time = atof (optarg) / 1000.f;
+				break;
+
+			case 's':
+				t.rate = atoi (optarg);
+				break;
+
+			case 'T':
+				true_peak = true;
+				break;
+
+			case 't':
+				threshold = atof (optarg);
+				break;
+
+			default:
+				fprintf (stderr, "Error: unrecognized option. See --help for usage information.\n");
+				::exit (EXIT_FAILURE);
+				break;
+		}
+	}
+
+	if (t.nchan < 1 || t.block < 1 || t.rate < 8000 || duration <= 0) {
+		fprintf (stderr, "Error: Invalid stream configuration.\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (queue < 2 || (queue & (queue - 1))) {
+		fprintf (stderr, "Error: Queue size must be a power of two (>= 2).\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (!t.ring.create (name, t.rate, t.nchan, t.block, queue)) {
+		fprintf (stderr, "Cannot create shared memory '%s'\n", name);
+		::exit (EXIT_FAILURE);
+	}
+
+	t.nblocks = (uint64_t)ceil (duration * t.rate / t.block);
+
+	if (optind < argc) {
+		fflush (stdout);
+		pid = fork ();
+		if (pid == 0) {
+			execvp (argv[optind], &argv[optind]);
+			fprintf (stderr, "Cannot execute '%s'\n", argv[optind]);
+			_exit (127);
+		} else if (pid < 0) {
+			fprintf (stderr, "Cannot start '%s'\n", argv[optind]);
+			::exit (EXIT_FAILURE);
+		}
+	} else {
+		printf ("Waiting for sound-gambit --shm %s\n", name);
+		fflush (stdout);
+	}
+
+	/* reference, processing the same blocks */
+	Peaklim ref;
+	ref.init (t.rate, t.nchan);
+	ref.set_inpgain (input_gain);
+	ref.set_threshold (threshold);
+	ref.set_release (release_time);
+	ref.set_truepeak (true_peak);
+
+	float*      buf = (float*)malloc (t.block * t.nchan * sizeof (float));
+	LatencyHist rtt;
+	uint64_t    received = 0;
+	float       maxdiff  = 0;
+	float       peak     = 0;
+	uint64_t    start    = ShmRing::now ();
+
+	pthread_t prod;
+	pthread_create (&prod, 0, producer, &t);
+
+	/* wait in short steps, to notice when the command exits early */
+	int      status = 0;
+	bool     exited = false;
+	uint64_t idle   = 0;
+
+	while (true) {
+		if (!t.ring.wait_read (100000000ULL)) {
+			if (t.ring.header ()->flags.load () & ShmRing::PROCESS_END) {
+				break;
+			}
+			if (pid > 0 && waitpid (pid, &status, WNOHANG) == pid) {
+				fprintf (stderr, "The limiter exited before processing all blocks\n");
+				exited  = true;
+				t.error = true;
+				break;
+			}
+			if (++idle == 50) {
+				fprintf (stderr, "Timeout, the limiter does not process blocks\n");
+				t.error = true;
+				break;
+			}
+			continue;
+		}
+		idle = 0;
+
+		uint64_t     stamp;
+		float const* b = t.ring.read_ptr (&stamp);
+		rtt.record (ShmRing::now () - stamp);
+
+		generate (buf, received * t.block, t.block, t.nchan, t.rate);
+		ref.process (t.block, buf, buf);
+		for (int i = 0; i < t.block * t.nchan; ++i) {
+			maxdiff = fmaxf (maxdiff, fabsf (b[i] - buf[i]));
+			peak    = fmaxf (peak, fabsf (b[i]));
+		}
+		t.ring.read_commit ();
+		++received;
+	}
+
+	double elapsed = (ShmRing::now () - start) / 1e9;
+
+	pthread_join (prod, 0);
+
+	if (pid > 0) {
+		if (!exited) {
+			if (t.error) {
+				kill (pid, SIGTERM);
+			}
+			waitpid (pid, &status, 0);
+		}
+		if (!WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+			fprintf (stderr, "Command failed\n");
+			rv = 1;
+		}
+	}
+
+	printf ("Blocks          : %" PRIu64 " of %" PRIu64 " x %d frames\n", received, t.nblocks, t.block);
+	printf ("Throughput      : %.1f x real-time\n", received * t.block / (double)t.rate / elapsed);
+	printf ("Round-trip      : p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+	        rtt.percentile (50) / 1e6, rtt.percentile (99) / 1e6, rtt.max () / 1e6);
+	printf ("Output peak     : %.2f dBFS\n", peak > 0 ? 20.f * log10f (peak) : -INFINITY);
+	printf ("Max. difference : %g\n", maxdiff);
+
+	if (t.error || received != t.nblocks || maxdiff > 0) {
+		rv = 1;
+	}
+
+	free (buf);
+	return rv;
+}
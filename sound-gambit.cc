@@ -22,13 +22,62 @@
 #include <getopt.h>
 #include <inttypes.h>
 #include <limits>
+#include <signal.h>
 #include <sndfile.h>
 
+#include "automation.h"
+#include "checksum.h"
+#include "flacwriter.h"
 #include "peaklim.h"
+#include "peaklim_stream.h"
+#include "regionreader.h"
+#include "rendercache.h"
+#include "shmring.h"
+#include "trace.h"
 #include "upsampler.h"
+#include "waveform.h"
 
 #define BLOCKSIZE 4096
 
+enum {
+	OPT_WAVEFORM = 0x100,
+	OPT_WAVEFORM_PPX,
+	OPT_WAVEFORM_SPLIT,
+	OPT_CHECKSUM,
+	OPT_CACHE,
+	OPT_SPARSE,
+	OPT_START,
+	OPT_DURATION,
+	OPT_EVENT_LOG,
+	OPT_EVENT_THRESHOLD,
+	OPT_AUTOMATION,
+	OPT_DECODE_THREADS,
+	OPT_FLAC_THREADS,
+	OPT_FLAC_LEVEL,
+	OPT_SHM,
+	OPT_TRACE,
+};
+
+struct Output {
+	Output ()
+	    : sf (NULL)
+	    , flac (NULL)
+	    , nchan (0)
+	    , bits (0)
+	    , qbuf (NULL)
+	{
+	}
+
+	SNDFILE*    sf;
+	FlacWriter* flac;
+	int         nchan;
+	int         bits; /* integer sample format, 0: float */
+	int32_t*    qbuf; /* quantized samples */
+	Waveform    wf;
+	Checksum    ck;
+	RenderCache cache;
+};
+
 static void
 usage ()
 {
@@ -41,8 +90,25 @@ usage ()
 	        "  -a, --auto-gain            specify gain relative to peak\n"
 	        "  -i, --input-gain <db>      input gain in dB (default 0)\n"
 	        "  -T, --true-peak            oversample, use true-peak threshold\n"
+	        "      --sparse-true-peak     only oversample where the threshold can be reached\n"
 	        "  -t, --threshold <dBFS>     threshold in dBFS/dBTP (default -1)\n"
 	        "  -r, --release-time <ms>    release-time in ms (default 10)\n"
+	        "  -j, --json <file>          write a processing report in JSON format\n"
+	        "      --waveform <file>      write a min/max waveform overview\n"
+	        "      --waveform-ppx <N>     waveform samples per pixel (default 256)\n"
+	        "      --waveform-split       per channel waveform instead of mixdown\n"
+	        "      --checksum <algo>      hash output samples (xxh32, xxh64)\n"
+	        "      --cache <dir>          reuse identical renders from given directory\n"
+	        "      --start <time>         only render the output from the given time\n"
+	        "      --duration <time>      only render the given duration\n"
+	        "      --event-log <file>     write a list of gain-reduction events\n"
+	        "      --event-threshold <db> minimum gain-reduction of an event (default 1)\n"
+	        "      --automation <file>    change parameters over time\n"
+	        "      --decode-threads <N>   decode seekable input files using N threads\n"
+	        "      --flac-threads <N>     encode FLAC output using N threads\n"
+	        "      --flac-level <0-8>     FLAC compression level (default 5)\n"
+	        "      --shm <name>           process a shared-memory ring, no files\n"
+	        "      --trace <file>         save a timeline of processing stages\n"
 	        "  -h, --help                 display this help and exit\n"
 	        "  -v, --verbose              show processing information\n"
 	        "  -V, --version              print version information and exit\n"
@@ -75,6 +141,72 @@ usage ()
 	        "the waveform and create excessive distortion. Short superimposed peaks\n"
 	        "will still have the release time as set by this control.\n"
 	        "\n"
+	        "With --sparse-true-peak, true-peak analysis is skipped for short\n"
+	        "segments where the digital peak is too low to produce an inter-sample\n"
+	        "peak above the threshold or the channel's true-peak so far. The output\n"
+	        "and the reported true-peak levels are identical.\n"
+	        "\n"
+	        "The JSON report includes peak and gain-reduction statistics: a histogram\n"
+	        "of the applied attenuation in 0.1 dB steps, the time spent above a given\n"
+	        "amount of gain-reduction, and the number of limiting events.\n"
+	        "Per channel input (with input-gain applied), output and true-peak\n"
+	        "levels are listed as well.\n"
+	        "Use '-' to print the report to standard output.\n"
+	        "\n"
+	        "A waveform overview of the output can be generated during processing.\n"
+	        "The file uses audiowaveform's data format (version 2, 16 bit), JSON if\n"
+	        "the file-name ends in '.json', binary otherwise.\n"
+	        "\n"
+	        "A checksum of the output audio data can be computed while writing.\n"
+	        "It is calculated from the samples as passed to the encoder (little-endian,\n"
+	        "interleaved), independent of file-format and meta-data: signed integers\n"
+	        "for 8, 16 and 24 bit output, 32-bit float otherwise.\n"
+	        "\n"
+	        "The render-cache stores the limiter output keyed by a hash of the input\n"
+	        "file, the version of this tool and the processing parameters. If the same\n"
+	        "job is submitted again, processing is skipped and the cached render is\n"
+	        "written along with the meta-data of the input file.\n"
+	        "This requires a seekable input file.\n"
+	        "\n"
+	        "An excerpt can be rendered using --start and/or --duration, specified\n"
+	        "in seconds or as [[hh:]mm:]ss[.fff]. Processing starts early enough\n"
+	        "for the limiter state to settle, the excerpt is identical to the same\n"
+	        "range of a complete render, within floating-point precision. Auto-gain\n"
+	        "still analyzes the complete file. Statistics only cover the excerpt.\n"
+	        "\n"
+	        "The event log lists each range where the limiter reduces the gain by more\n"
+	        "than the event-threshold, one tab-separated line per event: onset and\n"
+	        "duration in seconds, relative to the output, and the maximum\n"
+	        "gain-reduction in dB. The render cache is not used with --event-log.\n"
+	        "\n"
+	        "Input-gain, threshold and release-time can be automated. The automation\n"
+	        "file has one 'time parameter value' breakpoint per line, where parameter\n"
+	        "is one of input-gain, threshold or release, using the same units as the\n"
+	        "options above. '#' starts a comment. Input-gain changes are ramped over\n"
+	        "the next gain-update period, threshold changes use the look-ahead.\n"
+	        "\n"
+	        "Decoding compressed files (FLAC, Ogg) can be slower than limiting.\n"
+	        "With --decode-threads, each thread decodes successive regions of the\n"
+	        "input ahead of the limiter, using 512 kB per thread and channel.\n"
+	        "\n"
+	        "FLAC output can likewise be encoded in parallel. With --flac-threads,\n"
+	        "a built-in encoder compresses blocks of 4096 frames on a pool of\n"
+	        "threads, using the given --flac-level (0-8, default 5), otherwise\n"
+	        "libsndfile encodes on the processing thread. Vorbis comments are\n"
+	        "copied. This requires a seekable output file.\n"
+	        "\n"
+	        "With --shm <name>, no files are used. The limiter attaches to an\n"
+	        "existing shared-memory ring-buffer (see shmring.h), processes each\n"
+	        "block in-place as soon as the producer has written it, and exits when\n"
+	        "the producer finishes the stream. Rate, channel-count and block-size\n"
+	        "are those of the ring, and the output is delayed by the latency of\n"
+	        "the limiter. sound-gambit-shmtest is a producer and consumer for it.\n"
+	        "\n"
+	        "A timeline of the processing stages can be saved with --trace, in\n"
+	        "Chrome trace-event format (chrome://tracing or ui.perfetto.dev). Each\n"
+	        "block read, limited and written is a span, as well as the work and\n"
+	        "wait times of decode and FLAC encoder threads.\n"
+	        "\n"
 	        "The algorithm is based on Fons Adriaensen's zita-audiotools.\n");
 
 	printf ("\n"
@@ -96,6 +228,303 @@ coeff_to_dB (float coeff)
 	return 20.0f * log10f (coeff);
 }
 
+static sf_count_t
+read_input (SNDFILE* sf, RegionReader& r, float* buf, sf_count_t nframes)
+{
+	TraceSpan  t ("read");
+	sf_count_t n = r.enabled () ? r.readf (buf, nframes) : sf_readf_float (sf, buf, nframes);
+	if (!r.enabled () && sf_error (sf)) {
+		n = -1;
+	}
+	if (n < 0) {
+		fprintf (stderr, "Error reading input file.\n");
+	}
+	t.set_arg (n);
+	return n;
+}
+
+static sf_count_t
+seek_input (SNDFILE* sf, RegionReader& r, sf_count_t frame)
+{
+	TraceSpan t ("seek", frame);
+	return r.enabled () ? r.seek (frame) : sf_seek (sf, frame, SEEK_SET);
+}
+
+static volatile sig_atomic_t shm_stop = 0;
+
+static void
+catchsig (int)
+{
+	shm_stop = 1;
+}
+
+/* limit the blocks of a shared-memory ring in-place, until the producer is done */
+static int
+run_shm (const char* name, float input_gain, float threshold, float release_time, bool true_peak, bool sparse, int verbose)
+{
+	ShmRing ring;
+	if (!ring.open (name)) {
+		fprintf (stderr, "Cannot open shared memory '%s'\n", name);
+		return 1;
+	}
+
+	Peaklim p;
+	p.init (ring.rate (), ring.nchan ());
+	p.set_inpgain (input_gain);
+	p.set_threshold (threshold);
+	p.set_release (release_time);
+	p.set_truepeak (true_peak);
+	p.set_sparse (sparse);
+
+	if (verbose) {
+		printf ("Shared Memory   : %s\n", name);
+		printf ("Sample Rate     : %d Hz\n", ring.rate ());
+		printf ("Channels        : %d\n", ring.nchan ());
+		printf ("Block Size      : %d\n", ring.block ());
+		printf ("Latency         : %d frames\n", p.get_latency ());
+		fflush (stdout);
+	}
+
+	signal (SIGINT, catchsig);
+	signal (SIGTERM, catchsig);
+
+	uint64_t blocks = 0;
+	while (!shm_stop) {
+		/* wake up periodically to handle signals */
+		if (!ring.wait_process (100000000)) {
+			if (ring.header ()->flags.load () & ShmRing::WRITE_END) {
+				break;
+			}
+			continue;
+		}
+		float* buf = ring.process_ptr (0);
+		p.process (ring.block (), buf, buf);
+		ring.process_commit ();
+		++blocks;
+	}
+	ring.process_finish ();
+
+	if (verbose) {
+		float peak, gmax, gmin;
+		p.get_stats (&peak, &gmax, &gmin);
+		printf ("Blocks          : %" PRIu64 "\n", blocks);
+		printf ("Max-attenuation : %.2f dB\n", coeff_to_dB (gmin));
+	}
+	return 0;
+}
+
+/* process input, applying automation at its breakpoints */
+static int
+process_block (PeaklimStream& ps, Peaklim& p, Automation& a, int64_t& pos, int nframes, float const* inp, float* out)
+{
+	TraceSpan t ("limit", nframes);
+
+	int nchan = p.get_nchan ();
+	int rv    = 0;
+	for (int k = 0; k < nframes;) {
+		int n = a.apply (p, pos, nframes - k);
+		rv += ps.process (n, &inp[k * nchan], &out[rv * nchan]);
+		pos += n;
+		k += n;
+	}
+	return rv;
+}
+
+static void
+write_events (FILE* f, GrEventLog* ev, int rate, int offset)
+{
+	GrEventLog::Event e;
+	while (ev->pop (&e)) {
+		int64_t s = e.start > offset ? e.start - offset : 0;
+		fprintf (f, "%.3f\t%.3f\t%.2f\n", s / (double)rate, e.length / (double)rate, -coeff_to_dB (e.gain));
+	}
+}
+
+static void
+json_string (FILE* f, const char* s)
+{
+	fputc ('"', f);
+	for (; *s; ++s) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\') {
+			fprintf (f, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf (f, "\\u%04x", c);
+		} else {
+			fputc (c, f);
+		}
+	}
+	fputc ('"', f);
+}
+
+static void
+json_dB (FILE* f, float coeff)
+{
+	if (coeff < 1e-15) {
+		fprintf (f, "null");
+	} else {
+		fprintf (f, "%.2f", coeff_to_dB (coeff));
+	}
+}
+
+static void
+write_report (FILE* f, Peaklim const& p, SF_INFO const& nfo, char const* const* files,
+              float input_gain, float threshold, float release_time, bool true_peak, bool auto_gain,
+              double start, double duration, float peak, float gmin, Output const& o, bool cache_hit)
+{
+	static const float above[] = { 0.1f, 1.f, 3.f, 6.f, 10.f };
+
+	fprintf (f, "{\n  \"input\": ");
+	json_string (f, files[0]);
+	fprintf (f, ",\n  \"output\": ");
+	json_string (f, files[1]);
+	fprintf (f, ",\n  \"sample_rate\": %d", nfo.samplerate);
+	fprintf (f, ",\n  \"channels\": %d", nfo.channels);
+	fprintf (f, ",\n  \"input_gain\": %.2f", input_gain);
+	fprintf (f, ",\n  \"auto_gain\": %s", auto_gain ? "true" : "false");
+	fprintf (f, ",\n  \"threshold\": %.2f", threshold);
+	fprintf (f, ",\n  \"true_peak\": %s", true_peak ? "true" : "false");
+	fprintf (f, ",\n  \"release_time\": %.1f", release_time * 1000.f);
+	if (start > 0 || duration > 0) {
+		fprintf (f, ",\n  \"excerpt\": { \"start\": %.3f, \"duration\": ", start);
+		if (duration > 0) {
+			fprintf (f, "%.3f }", duration);
+		} else {
+			fprintf (f, "null }");
+		}
+	}
+	if (o.ck.algorithm () != Checksum::NONE) {
+		char hex[17];
+		char const* data = o.bits == 0 ? "float32le" : o.bits == 8 ? "s8" : o.bits == 16 ? "s16le" : "s24le";
+		fprintf (f, ",\n  \"checksum\": { \"algorithm\": \"%s\", \"data\": \"%s\", \"value\": \"%s\" }", o.ck.name (), data, o.ck.hex (hex));
+	}
+	if (o.cache.enabled ()) {
+		fprintf (f, ",\n  \"render_cache\": \"%s\"", cache_hit ? "hit" : "miss");
+	}
+	if (cache_hit) {
+		/* no processing took place, statistics are not available */
+		fprintf (f, "\n}\n");
+		return;
+	}
+	uint64_t const* hist = p.get_histogram ();
+	int             last = Peaklim::HIST_BINS;
+	while (last > 1 && hist[last - 1] == 0) {
+		--last;
+	}
+
+	fprintf (f, ",\n  \"peak_relative_to_threshold\": ");
+	json_dB (f, peak);
+	fprintf (f, ",\n  \"max_attenuation\": ");
+	json_dB (f, gmin);
+	fprintf (f, ",\n  \"limiting_events\": %" PRIu64, p.get_events ());
+	fprintf (f, ",\n  \"channel_stats\": [");
+	for (int c = 0; c < nfo.channels; ++c) {
+		float inp_peak, out_peak, tru_peak;
+		p.get_channel_stats (c, &inp_peak, &out_peak, &tru_peak);
+		fprintf (f, "%s\n    { \"input_peak\": ", c > 0 ? "," : "");
+		json_dB (f, inp_peak);
+		fprintf (f, ", \"output_peak\": ");
+		json_dB (f, out_peak);
+		fprintf (f, ", \"true_peak\": ");
+		json_dB (f, true_peak ? tru_peak : 0);
+		fprintf (f, " }");
+	}
+	fprintf (f, "\n  ]");
+	fprintf (f, ",\n  \"gain_reduction\": {\n    \"bin_width\": 0.1,\n    \"histogram\": [");
+	for (int i = 0; i < last; ++i) {
+		fprintf (f, "%s%" PRIu64, i > 0 ? ", " : "", hist[i]);
+	}
+	fprintf (f, "],\n    \"seconds_above\": {");
+	for (size_t i = 0; i < sizeof (above) / sizeof (float); ++i) {
+		fprintf (f, "%s\"%g\": %.3f", i > 0 ? ", " : "", above[i], p.get_frames_above (above[i]) / (double)nfo.samplerate);
+	}
+	fprintf (f, "}\n  }\n}\n");
+}
+
+static int
+write_frames (Output& o, float const* buf, int n)
+{
+	TraceSpan t ("write", n);
+	size_t    ns = (size_t)n * o.nchan;
+	o.wf.process (n, buf);
+	o.cache.write (buf, n);
+	if (o.bits == 0) {
+		o.ck.update (buf, ns);
+	} else if (o.sf || o.ck.algorithm () != Checksum::NONE) {
+		/* hash the integer samples that are written */
+		for (size_t i = 0; i < ns; ++i) {
+			o.qbuf[i] = FlacWriter::quantize (buf[i], o.bits);
+		}
+		o.ck.update (o.qbuf, ns, o.bits);
+	}
+	if (o.flac) {
+		return o.flac->write (buf, n);
+	}
+	if (o.bits > 0) {
+		/* libsndfile expects full-scale 32 bit */
+		for (size_t i = 0; i < ns; ++i) {
+			o.qbuf[i] *= 1 << (32 - o.bits);
+		}
+		return sf_writef_int (o.sf, o.qbuf, n);
+	}
+	return sf_writef_float (o.sf, buf, n);
+}
+
+/* bits per sample of integer formats up to 24 bit, 0 otherwise */
+static int
+pcm_bits (SF_INFO const& nfo)
+{
+	switch (nfo.format & SF_FORMAT_SUBMASK) {
+		case SF_FORMAT_PCM_S8:
+		case SF_FORMAT_PCM_U8:
+			return 8;
+		case SF_FORMAT_PCM_16:
+			return 16;
+		case SF_FORMAT_PCM_24:
+			return 24;
+		default:
+			return 0;
+	}
+}
+
+/* FLAC bits per sample, 0 if the native encoder does not apply */
+static int
+flac_bits (SF_INFO const& nfo)
+{
+	if ((nfo.format & SF_FORMAT_TYPEMASK) != SF_FORMAT_FLAC) {
+		return 0;
+	}
+	return pcm_bits (nfo);
+}
+
+static bool
+copy_tags (SNDFILE* infile, FlacWriter* fw)
+{
+	/* same mapping as libsndfile */
+	static const struct {
+		int         str;
+		const char* key;
+	} tags[] = {
+		{ SF_STR_TITLE, "TITLE" },
+		{ SF_STR_COPYRIGHT, "COPYRIGHT" },
+		{ SF_STR_SOFTWARE, "ENCODER" },
+		{ SF_STR_ARTIST, "ARTIST" },
+		{ SF_STR_COMMENT, "COMMENT" },
+		{ SF_STR_DATE, "DATE" },
+		{ SF_STR_ALBUM, "ALBUM" },
+		{ SF_STR_LICENSE, "LICENSE" },
+		{ SF_STR_TRACKNUMBER, "TRACKNUMBER" },
+		{ SF_STR_GENRE, "GENRE" },
+	};
+
+	for (size_t i = 0; i < sizeof (tags) / sizeof (tags[0]); ++i) {
+		if (!fw->add_tag (tags[i].key, sf_get_string (infile, tags[i].str))) {
+			return false;
+		}
+	}
+	return true;
+}
+
 static void
 copy_metadata (SNDFILE* infile, SNDFILE* outfile)
 {
@@ -129,6 +558,7 @@ main (int argc, char** argv)
 	float*     inp     = NULL;
 	float*     out     = NULL;
 	Peaklim    p;
+	Output     o;
 	Upsampler* u            = NULL;
 	int        latency      = 0;
 	int        rv           = 0;
@@ -136,23 +566,70 @@ main (int argc, char** argv)
 	float      threshold    = -1;   // dBFS/dBTP
 	float      release_time = 0.01; // ms
 	bool       true_peak    = false;
+	bool       sparse       = false;
 	bool       auto_gain    = false;
 	int        verbose      = 0;
 	float      peak         = 0;
+	float      peak_all     = 0;
+	float      gmin_all     = 1;
+	bool       cache_hit    = false;
 	FILE*      verbose_fd   = stdout;
+	double     start        = 0; // sec
+	double     duration     = 0; // sec, 0: until the end
+	sf_count_t todo         = -1;
+	int        settle       = 0;
+	bool       eof          = false;
+	float      event_db     = 1;
+	int        dec_threads  = 1;
+	int        flac_threads = 0;
+	int        flac_level   = 5;
+	FILE*      event_fd     = NULL;
 
-	const char* optstring = "ahi:r:Tt:Vv";
+	PeaklimStream ps;
+	Automation    automation;
+	RegionReader  reader;
+	FlacWriter    flac;
+	int64_t       pos = 0;
+
+	const char* json_file  = NULL;
+	const char* wave_file  = NULL;
+	const char* event_file = NULL;
+	const char* auto_file  = NULL;
+	const char* shm_name   = NULL;
+	const char* trace_file = NULL;
+	int         wave_spp   = 256;
+	bool        wave_mono  = true;
+
+	const char* optstring = "ahi:j:r:Tt:Vv";
 
 	/* clang-format off */
 	const struct option longopts[] = {
-		{ "auto-gain",    no_argument,       0, 'a' },
-		{ "input-gain",   required_argument, 0, 'i' },
-		{ "threshold",    required_argument, 0, 't' },
-		{ "true-peak",    no_argument      , 0, 'T' },
-		{ "release-time", required_argument, 0, 'r' },
-		{ "help",         no_argument,       0, 'h' },
-		{ "version",      no_argument,       0, 'V' },
-		{ "verbose",      no_argument,       0, 'v' },
+		{ "auto-gain",        no_argument,       0, 'a' },
+		{ "input-gain",       required_argument, 0, 'i' },
+		{ "json",             required_argument, 0, 'j' },
+		{ "threshold",        required_argument, 0, 't' },
+		{ "true-peak",        no_argument,       0, 'T' },
+		{ "release-time",     required_argument, 0, 'r' },
+		{ "help",             no_argument,       0, 'h' },
+		{ "version",          no_argument,       0, 'V' },
+		{ "verbose",          no_argument,       0, 'v' },
+		{ "waveform",         required_argument, 0, OPT_WAVEFORM },
+		{ "waveform-ppx",     required_argument, 0, OPT_WAVEFORM_PPX },
+		{ "waveform-split",   no_argument,       0, OPT_WAVEFORM_SPLIT },
+		{ "checksum",         required_argument, 0, OPT_CHECKSUM },
+		{ "cache",            required_argument, 0, OPT_CACHE },
+		{ "sparse-true-peak", no_argument,       0, OPT_SPARSE },
+		{ "start",            required_argument, 0, OPT_START },
+		{ "duration",         required_argument, 0, OPT_DURATION },
+		{ "event-log",        required_argument, 0, OPT_EVENT_LOG },
+		{ "event-threshold",  required_argument, 0, OPT_EVENT_THRESHOLD },
+		{ "automation",       required_argument, 0, OPT_AUTOMATION },
+		{ "decode-threads",   required_argument, 0, OPT_DECODE_THREADS },
+		{ "flac-threads",     required_argument, 0, OPT_FLAC_THREADS },
+		{ "flac-level",       required_argument, 0, OPT_FLAC_LEVEL },
+		{ "shm",              required_argument, 0, OPT_SHM },
+		{ "trace",            required_argument, 0, OPT_TRACE },
+		{ 0, 0, 0, 0 }
 	};
 	/* clang-format on */
 
@@ -172,6 +649,10 @@ main (int argc, char** argv)
 				usage ();
 				break;
 
+			case 'j':
+				json_file = optarg;
+				break;
+
 			case 'r':
 				release_time = atof (optarg) / 1000.f;
 				break;
@@ -194,6 +675,83 @@ main (int argc, char** argv)
 				++verbose;
 				break;
 
+			case OPT_WAVEFORM:
+				wave_file = optarg;
+				break;
+
+			case OPT_WAVEFORM_PPX:
+				wave_spp = atoi (optarg);
+				break;
+
+			case OPT_WAVEFORM_SPLIT:
+				wave_mono = false;
+				break;
+
+			case OPT_CHECKSUM:
+				o.ck.init (Checksum::parse (optarg));
+				if (o.ck.algorithm () == Checksum::NONE) {
+					fprintf (stderr, "Error: unknown checksum algorithm '%s'.\n", optarg);
+					::exit (EXIT_FAILURE);
+				}
+				break;
+
+			case OPT_CACHE:
+				o.cache.init (optarg);
+				break;
+
+			case OPT_SPARSE:
+				true_peak = true;
+				sparse    = true;
+				break;
+
+			case OPT_START:
+				start = Automation::parse_time (optarg);
+				if (start < 0) {
+					fprintf (stderr, "Error: invalid start time '%s'.\n", optarg);
+					::exit (EXIT_FAILURE);
+				}
+				break;
+
+			case OPT_DURATION:
+				duration = Automation::parse_time (optarg);
+				if (duration <= 0) {
+					fprintf (stderr, "Error: invalid duration '%s'.\n", optarg);
+					::exit (EXIT_FAILURE);
+				}
+				break;
+
+			case OPT_EVENT_LOG:
+				event_file = optarg;
+				break;
+
+			case OPT_EVENT_THRESHOLD:
+				event_db = atof (optarg);
+				break;
+
+			case OPT_AUTOMATION:
+				auto_file = optarg;
+				break;
+
+			case OPT_DECODE_THREADS:
+				dec_threads = atoi (optarg);
+				break;
+
+			case OPT_FLAC_THREADS:
+				flac_threads = atoi (optarg);
+				break;
+
+			case OPT_FLAC_LEVEL:
+				flac_level = atoi (optarg);
+				break;
+
+			case OPT_SHM:
+				shm_name = optarg;
+				break;
+
+			case OPT_TRACE:
+				trace_file = optarg;
+				break;
+
 			default:
 				fprintf (stderr, "Error: unrecognized option. See --help for usage information.\n");
 				::exit (EXIT_FAILURE);
@@ -201,6 +759,29 @@ main (int argc, char** argv)
 		}
 	}
 
+	if (release_time < 0.001 || release_time > 1.0) {
+		fprintf (stderr, "Error: Release-time is out of bounds (1 <= r <= 1000) [ms].\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (threshold < -10 || threshold > 0) {
+		fprintf (stderr, "Error: Threshold is out of bounds (-10 <= t <= 0) [dBFS].\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (input_gain < -10 || input_gain > 30) {
+		fprintf (stderr, "Error: Input-gain is out of bounds (-10 <= t <= 30) [dB].\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (shm_name) {
+		if (optind != argc || auto_gain) {
+			fprintf (stderr, "Error: --shm does not use files or auto-gain.\n");
+			::exit (EXIT_FAILURE);
+		}
+		return run_shm (shm_name, input_gain, threshold, release_time, true_peak, sparse, verbose);
+	}
+
 	if (optind + 2 > argc) {
 		fprintf (stderr, "Error: Missing parameter. See --help for usage information.\n");
 		::exit (EXIT_FAILURE);
@@ -213,23 +794,47 @@ main (int argc, char** argv)
 
 	if (0 == strcmp (argv[optind + 1], "-")) {
 		verbose_fd = stderr;
+		if (json_file && 0 == strcmp (json_file, "-")) {
+			fprintf (stderr, "Error: JSON report and audio output cannot both use stdout\n");
+			::exit (EXIT_FAILURE);
+		}
 	}
 
-	if (release_time < 0.001 || release_time > 1.0) {
-		fprintf (stderr, "Error: Release-time is out of bounds (1 <= r <= 1000) [ms].\n");
+	if (wave_spp < 1) {
+		fprintf (stderr, "Error: Waveform samples per pixel must be positive.\n");
 		::exit (EXIT_FAILURE);
 	}
 
-	if (threshold < -10 || threshold > 0) {
-		fprintf (stderr, "Error: Threshold is out of bounds (-10 <= t <= 0) [dBFS].\n");
+	if (dec_threads < 1 || dec_threads > 64) {
+		fprintf (stderr, "Error: Decode-threads is out of bounds (1 <= N <= 64).\n");
 		::exit (EXIT_FAILURE);
 	}
 
-	if (input_gain < -10 || input_gain > 30) {
-		fprintf (stderr, "Error: Input-gain is out of bounds (-10 <= t <= 30) [dB].\n");
+	if (flac_threads < 0 || flac_threads > 64) {
+		fprintf (stderr, "Error: FLAC-threads is out of bounds (0 <= N <= 64).\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (flac_level < 0 || flac_level > 8) {
+		fprintf (stderr, "Error: FLAC-level is out of bounds (0 <= l <= 8).\n");
 		::exit (EXIT_FAILURE);
 	}
 
+	if (event_db <= 0) {
+		fprintf (stderr, "Error: Event-threshold must be positive [dB].\n");
+		::exit (EXIT_FAILURE);
+	}
+
+	if (event_file && !(event_fd = fopen (event_file, "w"))) {
+		fprintf (stderr, "Cannot open '%s' for writing\n", event_file);
+		::exit (EXIT_FAILURE);
+	}
+
+	if (trace_file) {
+		Trace::enable ();
+		Trace::thread_name ("main");
+	}
+
 	memset (&nfo, 0, sizeof (SF_INFO));
 
 	if ((infile = sf_open (argv[optind], SFM_READ, &nfo)) == 0) {
@@ -244,17 +849,60 @@ main (int argc, char** argv)
 		goto end;
 	}
 
-	if ((outfile = sf_open (argv[optind + 1], SFM_WRITE, &nfo)) == 0) {
+	if (nfo.seekable && start * nfo.samplerate >= nfo.frames) {
+		fprintf (stderr, "Start time is beyond the end of the input\n");
+		rv = 1;
+		goto end;
+	}
+
+	if (dec_threads > 1) {
+		if (!nfo.seekable) {
+			fprintf (stderr, "Parallel decoding only works with seekable files\n");
+			rv = 1;
+			goto end;
+		}
+		/* 64k frames per region, two per thread */
+		if (!reader.open (argv[optind], dec_threads, 65536, 2 * dec_threads)) {
+			fprintf (stderr, "Cannot open '%s' for parallel decoding\n", argv[optind]);
+			rv = 1;
+			goto end;
+		}
+	}
+
+	if (!nfo.seekable && o.cache.enabled ()) {
+		fprintf (stderr, "Render cache only works with seekable files\n");
+		rv = 1;
+		goto end;
+	}
+
+	if (flac_threads > 0 && flac_bits (nfo) > 0 && strcmp (argv[optind + 1], "-")) {
+		if (nfo.channels > FlacWriter::MAX_CHANNELS) {
+			fprintf (stderr, "Cannot write '%s': FLAC supports up to %d channels\n", argv[optind + 1], FlacWriter::MAX_CHANNELS);
+			rv = 1;
+			goto end;
+		}
+		if (!flac.open (argv[optind + 1], nfo.samplerate, nfo.channels, flac_bits (nfo), flac_level, flac_threads)) {
+			fprintf (stderr, "Cannot open '%s' for writing\n", argv[optind + 1]);
+			rv = 1;
+			goto end;
+		}
+		o.flac = &flac;
+	} else if ((outfile = sf_open (argv[optind + 1], SFM_WRITE, &nfo)) == 0) {
 		fprintf (stderr, "Cannot open '%s' for writing: ", argv[optind + 1]);
 		fputs (sf_strerror (NULL), stderr);
 		rv = 1;
 		goto end;
 	}
 
-	inp = (float*)malloc (BLOCKSIZE * nfo.channels * sizeof (float));
-	out = (float*)malloc (BLOCKSIZE * nfo.channels * sizeof (float));
+	o.sf    = outfile;
+	o.nchan = nfo.channels;
+	o.bits  = pcm_bits (nfo);
+
+	inp    = (float*)malloc (BLOCKSIZE * nfo.channels * sizeof (float));
+	out    = (float*)malloc (BLOCKSIZE * nfo.channels * sizeof (float));
+	o.qbuf = (int32_t*)malloc (BLOCKSIZE * nfo.channels * sizeof (int32_t));
 
-	if (!inp || !out) {
+	if (!inp || !out || !o.qbuf) {
 		fprintf (stderr, "Out of memory\n");
 		rv = 1;
 		goto end;
@@ -270,13 +918,69 @@ main (int argc, char** argv)
 		fprintf (verbose_fd, "Channels        : %d\n", nfo.channels);
 	}
 
-	copy_metadata (infile, outfile);
+	if (o.flac) {
+		if (!copy_tags (infile, o.flac)) {
+			fprintf (stderr, "Out of memory\n");
+			rv = 1;
+			goto end;
+		}
+	} else {
+		copy_metadata (infile, outfile);
+	}
+
+	if (wave_file) {
+		o.wf.init (nfo.channels, wave_spp, !wave_mono);
+	}
+
+	if (o.cache.enabled ()) {
+		char params[256];
+		int  len = snprintf (params, sizeof (params), "sound-gambit %s sr=%d ch=%d i=%.4f t=%.4f r=%.6f T=%d a=%d",
+		                     VERSION, nfo.samplerate, nfo.channels, input_gain, threshold, release_time, true_peak, auto_gain);
+		if (start > 0 || duration > 0) {
+			snprintf (&params[len], sizeof (params) - len, " s=%.6f d=%.6f", start, duration);
+		}
+		o.cache.add_key (params, strlen (params));
+		/* the file as-is, decoding it is much slower */
+		if (!o.cache.add_file (argv[optind])) {
+			fprintf (stderr, "Cannot read '%s'\n", argv[optind]);
+			rv = 1;
+			goto end;
+		}
+	}
 
 	p.init (nfo.samplerate, nfo.channels);
 	p.set_inpgain (input_gain);
 	p.set_threshold (threshold);
 	p.set_release (release_time);
 	p.set_truepeak (true_peak);
+	p.set_sparse (sparse);
+	if (event_fd) {
+		p.set_event_log (event_db);
+	}
+	if (json_file) {
+		p.set_histogram (true);
+	}
+
+	if (auto_file) {
+		int err = automation.load (auto_file, nfo.samplerate, p.get_chunksize ());
+		if (err < 0) {
+			fprintf (stderr, "Cannot read automation '%s'\n", auto_file);
+			rv = 1;
+			goto end;
+		} else if (err > 0) {
+			fprintf (stderr, "Invalid automation in '%s' line %d\n", auto_file, err);
+			rv = 1;
+			goto end;
+		}
+		for (size_t i = 0; i < automation.size () && o.cache.enabled (); ++i) {
+			char key[64];
+			snprintf (key, sizeof (key), "%" PRId64 " %d %.4f", automation[i].frame, automation[i].param, automation[i].value);
+			o.cache.add_key (key, strlen (key));
+		}
+		if (verbose) {
+			fprintf (verbose_fd, "Automation      : %zu breakpoints\n", automation.size ());
+		}
+	}
 
 	if (auto_gain && true_peak) {
 		u = new Upsampler ();
@@ -284,10 +988,15 @@ main (int argc, char** argv)
 	}
 
 	while (auto_gain) {
-		int n = sf_readf_float (infile, inp, BLOCKSIZE);
+		int n = read_input (infile, reader, inp, BLOCKSIZE);
+		if (n < 0) {
+			rv = 1;
+			goto end;
+		}
 		if (n == 0) {
 			break;
 		}
+		TraceSpan t ("analyze", n);
 		if (true_peak) {
 			peak = u->process (n, peak, inp);
 		} else {
@@ -308,12 +1017,6 @@ main (int argc, char** argv)
 			}
 		}
 
-		if (0 != sf_seek (infile, 0, SEEK_SET)) {
-			fprintf (stderr, "Failed to rewind input file\n");
-			rv = 1;
-			goto end;
-		}
-
 		if (peak == 0) {
 			fprintf (stderr, "Input is silent, auto-peak is irrelevant\n");
 		} else {
@@ -327,76 +1030,209 @@ main (int argc, char** argv)
 				fprintf (verbose_fd, "Input Gain      : %.2f dB\n", gain + input_gain + threshold);
 			}
 			p.set_inpgain (gain + input_gain + threshold);
+			automation.set_gain_offset (gain + threshold);
 		}
 	}
 
-	latency = p.get_latency ();
-
-	do {
-		int n = sf_readf_float (infile, inp, BLOCKSIZE);
-		if (n == 0) {
-			break;
+	if (auto_gain) {
+		if (0 != seek_input (infile, reader, 0)) {
+			fprintf (stderr, "Failed to rewind input file\n");
+			rv = 1;
+			goto end;
 		}
-		p.process (n, inp, out);
-		if (latency > 0) {
-			int ns = n > latency ? n - latency : 0;
-			if (ns > 0) {
-				if (ns != sf_writef_float (outfile, &out[nfo.channels * latency], ns)) {
+	}
+
+	if (o.cache.enabled () && !event_fd) {
+		SNDFILE* cf = o.cache.lookup (&nfo);
+		if (cf) {
+			cache_hit = true;
+			int n;
+			while ((n = sf_readf_float (cf, out, BLOCKSIZE)) > 0) {
+				if (n != write_frames (o, out, n)) {
 					fprintf (stderr, "Error writing to output file.\n");
+					sf_close (cf);
 					rv = 1;
 					goto end;
 				}
 			}
+			sf_close (cf);
+			goto written;
+		}
+		if (!o.cache.create (nfo.samplerate, nfo.channels)) {
+			fprintf (stderr, "Cannot create render cache entry '%s'\n", o.cache.path ());
+		}
+	}
 
-			if (n >= latency) {
-				latency = 0;
-			} else {
-				latency -= n;
+	ps.init (&p);
+
+	if (start > 0 || duration > 0) {
+		/* start early, so that the limiter state has settled at `start` */
+		sf_count_t s0  = (sf_count_t)llround (start * nfo.samplerate);
+		sf_count_t pre = p.get_preroll (s0);
+		/* whole chunks, the remainder is discarded with the latency */
+		settle = s0 % p.get_chunksize ();
+		pos = s0 - pre;
+		if (nfo.seekable) {
+			if (s0 - pre != seek_input (infile, reader, s0 - pre)) {
+				fprintf (stderr, "Failed to seek input file\n");
+				rv = 1;
+				goto end;
+			}
+		} else {
+			for (sf_count_t skip = s0 - pre; skip > 0;) {
+				int n = read_input (infile, reader, inp, skip > BLOCKSIZE ? BLOCKSIZE : skip);
+				if (n < 0) {
+					rv = 1;
+					goto end;
+				}
+				if (n == 0) {
+					break;
+				}
+				skip -= n;
+			}
+		}
+		/* the output until `start` is discarded */
+		ps.skip (pre);
+		for (pre -= settle; pre > 0;) {
+			int n = read_input (infile, reader, inp, pre > BLOCKSIZE ? BLOCKSIZE : pre);
+			if (n < 0) {
+				rv = 1;
+				goto end;
+			}
+			if (n == 0) {
+				break;
+			}
+			process_block (ps, p, automation, pos, n, inp, out);
+			pre -= n;
+		}
+		p.reset_stats ();
+
+		if (duration > 0) {
+			todo = (sf_count_t)llround (duration * nfo.samplerate);
+		}
+	}
+
+	while (todo != 0) {
+		int n = eof ? 0 : read_input (infile, reader, inp, BLOCKSIZE);
+		if (n < 0) {
+			rv = 1;
+			goto end;
+		}
+		if (n > 0) {
+			n = process_block (ps, p, automation, pos, n, inp, out);
+		} else {
+			/* end of input, flush the delay-line */
+			TraceSpan t ("drain");
+			eof = true;
+			n   = ps.flush (out, BLOCKSIZE);
+			if (n == 0) {
+				break;
 			}
+		}
+		if (event_fd) {
+			write_events (event_fd, p.get_event_log (), nfo.samplerate, settle);
+		}
+		if (n == 0) {
 			continue;
 		}
+		if (todo > 0) {
+			n = n < todo ? n : todo;
+			todo -= n;
+		}
 
 		if (verbose > 2) {
 			float peak, gmax, gmin;
 			p.get_stats (&peak, &gmax, &gmin);
+			peak_all = fmaxf (peak_all, peak);
+			gmin_all = fminf (gmin_all, gmin);
 			fprintf (verbose_fd, "Level relative to threshold: %6.1fdB, max-gain: %4.1fdB, min-gain: %4.1fdB\n",
 			         coeff_to_dB (peak), coeff_to_dB (gmax), coeff_to_dB (gmin));
 		}
 
-		if (n != sf_writef_float (outfile, out, n)) {
+		if (n != write_frames (o, out, n)) {
 			fprintf (stderr, "Error writing to output file.\n");
 			rv = 1;
 			goto end;
 		}
-	} while (1);
+	}
 
-	memset (inp, 0, BLOCKSIZE * nfo.channels * sizeof (float));
-	latency = p.get_latency ();
-	while (latency > 0) {
-		int n = latency > BLOCKSIZE ? BLOCKSIZE : latency;
-		p.process (n, inp, out);
-		if (n != sf_writef_float (outfile, out, n)) {
-			fprintf (stderr, "Error writing to output file.\n");
-			rv = 1;
-			goto end;
+	o.cache.commit ();
+
+	if (event_fd) {
+		p.get_event_log ()->flush ();
+		write_events (event_fd, p.get_event_log (), nfo.samplerate, settle);
+		if (p.get_event_log ()->dropped () > 0) {
+			fprintf (stderr, "Event log overflow, %" PRIu64 " events were dropped\n", p.get_event_log ()->dropped ());
 		}
-		latency -= n;
+	}
+
+written:
+	if (o.flac && !o.flac->close ()) {
+		fprintf (stderr, "Error writing to output file.\n");
+		rv = 1;
+		goto end;
+	}
+
+	{
+		float peak, gmax, gmin;
+		p.get_stats (&peak, &gmax, &gmin);
+		peak_all = fmaxf (peak_all, peak);
+		gmin_all = fminf (gmin_all, gmin);
 	}
 
 	if (verbose) {
 		fprintf (verbose_fd, "Output File     : %s\n", argv[optind + 1]);
-		if (verbose < 3) {
-			float peak, gmax, gmin;
-			p.get_stats (&peak, &gmax, &gmin);
-			fprintf (verbose_fd, "Max-attenuation : %.2f dB\n", coeff_to_dB (gmin));
+		if (o.cache.enabled ()) {
+			fprintf (verbose_fd, "Render Cache    : %s\n", cache_hit ? "hit" : "miss");
+		}
+		if (verbose < 3 && !cache_hit) {
+			fprintf (verbose_fd, "Max-attenuation : %.2f dB\n", coeff_to_dB (gmin_all));
+		}
+		if (o.ck.algorithm () != Checksum::NONE) {
+			char hex[17];
+			fprintf (verbose_fd, "Checksum        : %s %s\n", o.ck.name (), o.ck.hex (hex));
+		}
+	}
+
+	if (wave_file && !o.wf.save (wave_file, nfo.samplerate)) {
+		fprintf (stderr, "Cannot write waveform to '%s'\n", wave_file);
+		rv = 1;
+	}
+
+	if (json_file) {
+		FILE* f = strcmp (json_file, "-") ? fopen (json_file, "w") : stdout;
+		if (!f) {
+			fprintf (stderr, "Cannot open '%s' for writing\n", json_file);
+			rv = 1;
+			goto end;
+		}
+		write_report (f, p, nfo, &argv[optind], input_gain, threshold, release_time, true_peak, auto_gain, start, duration, peak_all, gmin_all, o, cache_hit);
+		if (f != stdout) {
+			fclose (f);
 		}
 	}
 
 end:
+	if (event_fd) {
+		fclose (event_fd);
+	}
 	sf_close (infile);
-	sf_close (outfile);
+	if (outfile) {
+		sf_close (outfile);
+	}
 	delete u;
 	free (inp);
 	free (out);
+	free (o.qbuf);
+
+	if (trace_file) {
+		/* join decode and encode threads first */
+		reader.close ();
+		flac.close ();
+		if (!Trace::save (trace_file)) {
+			fprintf (stderr, "Cannot write trace to '%s'\n", trace_file);
+			rv = 1;
+		}
+	}
 	return rv;
 }
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+bool                        Trace::_enabled = false;
+__thread Trace::Thread*     Trace::_self    = 0;
+std::atomic<Trace::Thread*> Trace::_threads (0);
+
+static std::atomic<int> next_tid (1);
+
+/* chunks allocated and touched by enable(), so that page-faults
+ * do not add to the spans of the first events.
+ */
+enum { POOL = 32 };
+static std::atomic<Trace::Chunk*> pool (0);
+
+/* calibration of the tick counter */
+static uint64_t tick0;
+static uint64_t ns0;
+
+static uint64_t
+clock_ns ()
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+Trace::enable ()
+{
+	for (int i = 0; i < POOL; ++i) {
+		Chunk* c = (Chunk*)malloc (sizeof (Chunk));
+		/* write every page, zeroing might only map them */
+		for (int k = 0; k < CHUNK; ++k) {
+			c->ev[k].arg = -1;
+		}
+		c->next = pool.load ();
+		pool.store (c);
+	}
+	tick0    = now ();
+	ns0      = clock_ns ();
+	_enabled = true;
+}
+
+Trace::Thread*
+Trace::self ()
+{
+	if (!_self) {
+		Thread* t = (Thread*)calloc (1, sizeof (Thread));
+		t->tid    = next_tid++;
+		snprintf (t->name, sizeof (t->name), "thread %d", t->tid);
+
+		Thread* head = _threads.load ();
+		do {
+			t->next = head;
+		} while (!_threads.compare_exchange_weak (head, t));
+		_self = t;
+	}
+	return _self;
+}
+
+Trace::Chunk*
+Trace::grow ()
+{
+	Thread* t = self ();
+
+	/* chunks are never returned to the pool, so there is no ABA */
+	Chunk* c = pool.load ();
+	while (c && !pool.compare_exchange_weak (c, c->next)) {
+	}
+	if (!c) {
+		c = (Chunk*)malloc (sizeof (Chunk));
+	}
+	c->n      = 0;
+	c->next   = 0;
+	if (t->cur) {
+		t->cur->next = c;
+	} else {
+		t->first = c;
+	}
+	t->cur = c;
+	return c;
+}
+
+void
+Trace::thread_name (const char* name, int index)
+{
+	if (!_enabled) {
+		return;
+	}
+	Thread* t = self ();
+	if (index >= 0) {
+		snprintf (t->name, sizeof (t->name), "%s %d", name, index);
+	} else {
+		snprintf (t->name, sizeof (t->name), "%s", name);
+	}
+}
+
+bool
+Trace::save (const char* path)
+{
+	FILE* f = fopen (path, "w");
+	if (!f) {
+		return false;
+	}
+
+	/* ticks to microseconds since enable () */
+	uint64_t dt    = now () - tick0;
+	uint64_t dn    = clock_ns () - ns0;
+	double   scale = dt > 0 ? 1e-3 * dn / (double)dt : 0;
+
+	fprintf (f, "{\"traceEvents\": [\n");
+	bool first = true;
+	for (Thread* t = _threads.load (); t; t = t->next) {
+		fprintf (f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+		         first ? "" : ",\n", t->tid, t->name);
+		first = false;
+		for (Chunk* c = t->first; c; c = c->next) {
+			for (int i = 0; i < c->n; ++i) {
+				Event const& e = c->ev[i];
+				fprintf (f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+				         e.name, t->tid, (e.start - tick0) * scale, (e.end - e.start) * scale);
+				if (e.arg >= 0) {
+					fprintf (f, ", \"args\": {\"n\": %" PRId64 "}", e.arg);
+				}
+				fputc ('}', f);
+			}
+		}
+	}
+	fprintf (f, "\n],\n\"displayTimeUnit\": \"ns\"}\n");
+	return fclose (f) == 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Timeline of processing stages, saved as Chrome trace-event JSON
+ * (chrome://tracing, ui.perfetto.dev).
+ *
+ * Spans are appended to a buffer of the calling thread, which only
+ * that thread writes, so recording needs no locks or atomics, only a
+ * time-stamp counter read at the start and end. Buffers grow in chunks
+ * of CHUNK events, the first ones taken from a pool that enable()
+ * allocates up-front. save() must be called after all traced threads have
+ * finished. While tracing is disabled, a span only tests a flag.
+ */
+class Trace
+{
+public:
+	enum {
+		CHUNK = 4096
+	};
+
+	struct Event {
+		uint64_t    start; /* ticks */
+		uint64_t    end;
+		const char* name; /* static string */
+		int64_t     arg;  /* shown as `n`, unless negative */
+	};
+
+	/* start recording, before any thread is traced */
+	static void enable ();
+
+	/* write all recorded spans, false on error */
+	static bool save (const char* path);
+
+	static bool
+	enabled ()
+	{
+		return _enabled;
+	}
+
+	/* name the calling thread in the timeline */
+	static void thread_name (const char* name, int index = -1);
+
+	static uint64_t
+	now ()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc ();
+#else
+		struct timespec ts;
+		clock_gettime (CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+	}
+
+	static void
+	record (const char* name, uint64_t start, uint64_t end, int64_t arg)
+	{
+		Chunk* c = _self ? _self->cur : 0;
+		if (!c || c->n == CHUNK) {
+			c = grow ();
+		}
+		Event& e = c->ev[c->n++];
+		e.start  = start;
+		e.end    = end;
+		e.name   = name;
+		e.arg    = arg;
+	}
+
+	struct Chunk {
+		Event  ev[CHUNK];
+		int    n;
+		Chunk* next;
+	};
+
+private:
+	struct Thread {
+		int     tid;
+		char    name[32];
+		Chunk*  first;
+		Chunk*  cur;
+		Thread* next;
+	};
+
+	static Chunk*  grow ();
+	static Thread* self ();
+
+	static bool                 _enabled;
+	static __thread Thread*     _self;    /* of the calling thread */
+	static std::atomic<Thread*> _threads; /* all that recorded spans, pushed lock-free */
+};
+
+/* Record the scope as a span, e.g. TraceSpan s ("read"); */
+class TraceSpan
+{
+public:
+	TraceSpan (const char* name, int64_t arg = -1)
+		: _name (name)
+		, _arg (arg)
+		, _start (Trace::enabled () ? Trace::now () : 0)
+	{
+	}
+
+	~TraceSpan ()
+	{
+		if (_start) {
+			Trace::record (_name, _start, Trace::now (), _arg);
+		}
+	}
+
+	void
+	set_arg (int64_t arg)
+	{
+		_arg = arg;
+	}
+
+private:
+	const char* _name;
+	int64_t     _arg;
+	uint64_t    _start;
+};
+
+#endif
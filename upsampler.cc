@@ -17,11 +17,42 @@
 
 #include <algorithm>
 #include <math.h>
+#include <string.h>
 
 #include "upsampler.h"
 
+/* polyphase coefficients of process_one() for the channel-major
+ * process_frame(). The 3rd phase is the time-reverse of the first.
+ */
+/* clang-format off */
+static const float fir1[48] = {
+	-2.330790e-05f, +1.321291e-04f, -3.394408e-04f, +6.562235e-04f, -1.094138e-03f, +1.665807e-03f,
+	-2.385230e-03f, +3.268371e-03f, -4.334012e-03f, +5.604985e-03f, -7.109989e-03f, +8.886314e-03f,
+	-1.098403e-02f, +1.347264e-02f, -1.645206e-02f, +2.007155e-02f, -2.456432e-02f, +3.031531e-02f,
+	-3.800644e-02f, +4.896667e-02f, -6.616853e-02f, +9.788141e-02f, -1.788607e-01f, +9.000753e-01f,
+	+2.993829e-01f, -1.269367e-01f, +7.922398e-02f, -5.647748e-02f, +4.295093e-02f, -3.385706e-02f,
+	+2.724946e-02f, -2.218943e-02f, +1.816976e-02f, -1.489313e-02f, +1.217411e-02f, -9.891211e-03f,
+	+7.961470e-03f, -6.326144e-03f, +4.942202e-03f, -3.777065e-03f, +2.805240e-03f, -2.006106e-03f,
+	+1.362416e-03f, -8.592768e-04f, +4.834383e-04f, -2.228007e-04f, +6.607267e-05f, -2.537056e-06f,
+};
+
+static const float fir2[48] = {
+	-1.450055e-05f, +1.359163e-04f, -3.928527e-04f, +8.006445e-04f, -1.375510e-03f, +2.134915e-03f,
+	-3.098103e-03f, +4.286860e-03f, -5.726614e-03f, +7.448018e-03f, -9.489286e-03f, +1.189966e-02f,
+	-1.474471e-02f, +1.811472e-02f, -2.213828e-02f, +2.700557e-02f, -3.301023e-02f, +4.062971e-02f,
+	-5.069345e-02f, +6.477499e-02f, -8.625619e-02f, +1.239454e-01f, -2.101678e-01f, +6.359382e-01f,
+	+6.359382e-01f, -2.101678e-01f, +1.239454e-01f, -8.625619e-02f, +6.477499e-02f, -5.069345e-02f,
+	+4.062971e-02f, -3.301023e-02f, +2.700557e-02f, -2.213828e-02f, +1.811472e-02f, -1.474471e-02f,
+	+1.189966e-02f, -9.489286e-03f, +7.448018e-03f, -5.726614e-03f, +4.286860e-03f, -3.098103e-03f,
+	+2.134915e-03f, -1.375510e-03f, +8.006445e-04f, -3.928527e-04f, +1.359163e-04f, -1.450055e-05f,
+};
+/* clang-format on */
+
 Upsampler::Upsampler ()
 	: _nchan (0)
+	, _stride (0)
+	, _pos (0)
+	, _own (false)
 	, _z (0)
 {
 }
@@ -34,26 +65,71 @@ Upsampler::~Upsampler ()
 void
 Upsampler::fini ()
 {
-	for (int i = 0; i < _nchan; ++i) {
-		delete[] _z[i];
+	if (_own) {
+		delete[] _z;
+	}
+	_nchan  = 0;
+	_z      = 0;
+	_own    = false;
+	_stride = 0;
+}
+
+int
+Upsampler::mem_size (int nchan, bool frame_major)
+{
+	if (frame_major) {
+		/* history as [tap][channel], written twice so that
+		 * 48 consecutive rows are always available */
+		return 96 * ((nchan + LANES - 1) & ~(LANES - 1));
 	}
-	delete[] _z;
-	_nchan = 0;
-	_z     = 0;
+	return 48 * nchan;
 }
 
 void
-Upsampler::init (int nchan)
+Upsampler::init (int nchan, bool frame_major)
 {
 	fini ();
+	init (nchan, frame_major, new float[mem_size (nchan, frame_major)]);
+	_own = true;
+}
 
-	_nchan = nchan;
-	_z     = new float*[nchan];
-	for (int i = 0; i < _nchan; ++i) {
-		_z[i] = new float[48];
-		for (int j = 0; j < 48; ++j) {
-			_z[i][j] = 0.0f;
+void
+Upsampler::init (int nchan, bool frame_major, float* mem)
+{
+	fini ();
+	_nchan  = nchan;
+	_stride = frame_major ? (nchan + LANES - 1) & ~(LANES - 1) : 0;
+	_z      = mem;
+	reset ();
+}
+
+void
+Upsampler::assign (Upsampler const& o, float* mem)
+{
+	fini ();
+	_nchan  = o._nchan;
+	_stride = o._stride;
+	_pos    = o._pos;
+	_z      = mem;
+}
+
+void
+Upsampler::reset ()
+{
+	int n = _stride > 0 ? 96 * _stride : 48 * _nchan;
+	memset (_z, 0, n * sizeof (float));
+	_pos = 0;
+}
+
+void
+Upsampler::reset (int chn)
+{
+	if (_stride > 0) {
+		for (int t = 0; t < 96; ++t) {
+			_z[t * _stride + chn] = 0;
 		}
+	} else {
+		memset (&_z[48 * chn], 0, 48 * sizeof (float));
 	}
 }
 
@@ -76,7 +152,7 @@ Upsampler::process (int nframes, float pk, float const* inp)
 float
 Upsampler::process_one (int chn, float const x)
 {
-	float* r = _z[chn];
+	float* r = &_z[48 * chn];
 	float  u[4];
 	r[47] = x;
 	/* 4x upsample for true-peak analysis, cosine windowed sinc
@@ -134,3 +210,89 @@ Upsampler::process_one (int chn, float const x)
 	float p2 = std::max (fabsf (u[2]), fabsf (u[3]));
 	return std::max (p1, p2);
 }
+
+float
+Upsampler::hist_peak (int chn) const
+{
+	float const* r  = &_z[48 * chn];
+	float        pk = 0;
+	for (int i = 0; i < 47; ++i) {
+		pk = std::max (pk, fabsf (r[i]));
+	}
+	return pk;
+}
+
+void
+Upsampler::skip (int chn, float const* x, int n)
+{
+	float* r = &_z[48 * chn];
+	if (n <= 0) {
+		return;
+	}
+	if (n < 47) {
+		memmove (r, &r[n], (47 - n) * sizeof (float));
+		memcpy (&r[47 - n], x, n * sizeof (float));
+	} else {
+		memcpy (r, &x[n - 47], 47 * sizeof (float));
+	}
+	r[47] = x[n - 1];
+}
+
+void
+Upsampler::push_frame (float const* x)
+{
+	float* r0 = &_z[_pos * _stride];
+	float* r1 = &_z[(_pos + 48) * _stride];
+	for (int c = 0; c < _nchan; ++c) {
+		r0[c] = r1[c] = x[c];
+	}
+	_pos = (_pos + 1) % 48;
+}
+
+void
+Upsampler::process_frame (float const* x, float* pk)
+{
+	push_frame (x);
+
+	/* rows [_pos .. _pos + 47] are r[0] .. r[47] of process_one() */
+	float const* r = &_z[_pos * _stride];
+
+	for (int c0 = 0; c0 < _nchan; c0 += LANES) {
+		/* two partial sums per phase, to shorten dependency chains */
+		float u1[2][LANES], u2[2][LANES], u3[2][LANES];
+		for (int l = 0; l < LANES; ++l) {
+			u1[0][l] = u2[0][l] = u3[0][l] = 0.f;
+			u1[1][l] = u2[1][l] = u3[1][l] = 0.f;
+		}
+		for (int t = 0; t < 48; t += 2) {
+			float const* h0 = &r[t * _stride + c0];
+			float const* h1 = &r[(t + 1) * _stride + c0];
+			for (int l = 0; l < LANES; ++l) {
+				u1[0][l] += h0[l] * fir1[t];
+				u2[0][l] += h0[l] * fir2[t];
+				u3[0][l] += h0[l] * fir1[47 - t];
+				u1[1][l] += h1[l] * fir1[t + 1];
+				u2[1][l] += h1[l] * fir2[t + 1];
+				u3[1][l] += h1[l] * fir1[46 - t];
+			}
+		}
+		int nl = std::min ((int)LANES, _nchan - c0);
+		for (int l = 0; l < nl; ++l) {
+			float p1   = std::max (fabsf (x[c0 + l]), fabsf (u1[0][l] + u1[1][l]));
+			float p2   = std::max (fabsf (u2[0][l] + u2[1][l]), fabsf (u3[0][l] + u3[1][l]));
+			pk[c0 + l] = std::max (p1, p2);
+		}
+	}
+}
+
+float
+Upsampler::hist_peak_frames () const
+{
+	/* the 47 most recent frames */
+	float const* r  = &_z[(_pos + 1) * _stride];
+	float        pk = 0;
+	for (int i = 0; i < 47 * _stride; ++i) {
+		pk = std::max (pk, fabsf (r[i]));
+	}
+	return pk;
+}
@@ -24,9 +24,23 @@ public:
 	Upsampler (void);
 	~Upsampler (void);
 
-	void init (int nchan);
+	void init (int nchan, bool frame_major = false);
 	void fini ();
 
+	/* use caller-owned history of mem_size() floats, no allocation */
+	void init (int nchan, bool frame_major, float* mem);
+	/* clear the history */
+	void reset ();
+	/* clear the history of one channel */
+	void reset (int chn);
+
+	/* continue where `other` is, using caller-owned memory `mem`
+	 * that already holds a copy of its history.
+	 */
+	void assign (Upsampler const& other, float* mem);
+
+	static int mem_size (int nchan, bool frame_major);
+
 	int
 	get_latency () const
 	{
@@ -36,9 +50,42 @@ public:
 	float process (int nsamp, float pk, float const* inp);
 	float process_one (int chn, float const x);
 
+	/* Upper bound of process_one() output relative to the digital peak
+	 * of the input-history: the max L1 norm of the polyphase filters.
+	 */
+	static float
+	gain_bound ()
+	{
+		return 2.7485f;
+	}
+
+	/* digital peak of the filter-history (previous 47 samples) */
+	float hist_peak (int chn) const;
+
+	/* update history without computing output, same as calling
+	 * process_one() for each sample and ignoring the result.
+	 */
+	void skip (int chn, float const* x, int n);
+
+	/* Channel-major variant, for multi-channel signals. Must be
+	 * initialized with frame_major. Advances all channels by one
+	 * frame, processing LANES channels at a time.
+	 */
+	void  process_frame (float const* x, float* pk);
+	void  push_frame (float const* x);
+	float hist_peak_frames () const;
+
 private:
-	int     _nchan;
-	float** _z;
+	Upsampler (Upsampler const&);
+	Upsampler& operator= (Upsampler const&);
+
+	enum { LANES = 8 };
+
+	int    _nchan;
+	int    _stride; /* frame-major only */
+	int    _pos;
+	bool   _own;
+	float* _z; /* [channel][48], or [96][_stride] frame-major */
 };
 
 #endif
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "waveform.h"
+
+Waveform::Waveform (void)
+	: _nchan (0)
+	, _nout (0)
+	, _spp (0)
+	, _cnt (0)
+	, _gain (1)
+	, _min (0)
+	, _max (0)
+	, _data (0)
+	, _length (0)
+	, _alloc (0)
+	, _failed (false)
+{
+}
+
+Waveform::~Waveform (void)
+{
+	fini ();
+}
+
+void
+Waveform::init (int nchan, int samples_per_pixel, bool split)
+{
+	fini ();
+
+	_nchan = nchan;
+	_nout  = split ? nchan : 1;
+	_spp   = samples_per_pixel;
+	_gain  = split ? 1.f : 1.f / nchan;
+	_min   = new float[_nout];
+	_max   = new float[_nout];
+
+	reset ();
+}
+
+/* start a bucket, any sample replaces both extremes */
+void
+Waveform::reset ()
+{
+	for (int c = 0; c < _nout; ++c) {
+		_min[c] = FLT_MAX;
+		_max[c] = -FLT_MAX;
+	}
+	_cnt = 0;
+}
+
+void
+Waveform::fini (void)
+{
+	delete[] _min;
+	delete[] _max;
+	free (_data);
+	_min    = 0;
+	_max    = 0;
+	_data   = 0;
+	_nchan  = 0;
+	_cnt    = 0;
+	_length = 0;
+	_alloc  = 0;
+	_failed = false;
+}
+
+static int16_t
+to_int16 (float v)
+{
+	long s = lrintf (v * 32767.f);
+	if (s > 32767) {
+		return 32767;
+	}
+	if (s < -32768) {
+		return -32768;
+	}
+	return s;
+}
+
+void
+Waveform::flush ()
+{
+	if (_length == _alloc && !_failed) {
+		uint32_t alloc = _alloc ? 2 * _alloc : 8192;
+		int16_t* data  = (int16_t*)realloc (_data, (size_t)alloc * 2 * _nout * sizeof (int16_t));
+		if (data) {
+			_data  = data;
+			_alloc = alloc;
+		} else {
+			_failed = true;
+		}
+	}
+
+	if (!_failed) {
+		int16_t* d = &_data[_length * 2 * _nout];
+		for (int c = 0; c < _nout; ++c) {
+			d[2 * c]     = to_int16 (_min[c]);
+			d[2 * c + 1] = to_int16 (_max[c]);
+		}
+		++_length;
+	}
+	reset ();
+}
+
+void
+Waveform::process (int nframes, float const* buf)
+{
+	if (_nchan == 0) {
+		return;
+	}
+
+	while (nframes > 0) {
+		int n = _spp - _cnt;
+		if (n > nframes) {
+			n = nframes;
+		}
+		if (_nout == 1) {
+			float vmin = _min[0];
+			float vmax = _max[0];
+			for (int i = 0; i < n; ++i) {
+				float v = 0;
+				for (int c = 0; c < _nchan; ++c) {
+					v += buf[i * _nchan + c];
+				}
+				v *= _gain;
+				vmin = fminf (vmin, v);
+				vmax = fmaxf (vmax, v);
+			}
+			_min[0] = vmin;
+			_max[0] = vmax;
+		} else {
+			for (int c = 0; c < _nchan; ++c) {
+				float vmin = _min[c];
+				float vmax = _max[c];
+				for (int i = 0; i < n; ++i) {
+					vmin = fminf (vmin, buf[i * _nchan + c]);
+					vmax = fmaxf (vmax, buf[i * _nchan + c]);
+				}
+				_min[c] = vmin;
+				_max[c] = vmax;
+			}
+		}
+
+		buf += n * _nchan;
+		nframes -= n;
+		_cnt += n;
+		if (_cnt == _spp) {
+			flush ();
+		}
+	}
+}
+
+static void
+write_le32 (FILE* f, uint32_t v)
+{
+	unsigned char b[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+	fwrite (b, 1, 4, f);
+}
+
+bool
+Waveform::save (const char* path, int samplerate)
+{
+	if (_nchan == 0) {
+		return false;
+	}
+	if (_cnt > 0) {
+		flush ();
+	}
+	if (_failed) {
+		return false;
+	}
+
+	FILE* f = fopen (path, "wb");
+	if (!f) {
+		return false;
+	}
+
+	size_t len  = strlen (path);
+	bool   json = len > 5 && 0 == strcasecmp (&path[len - 5], ".json");
+
+	if (json) {
+		fprintf (f, "{\"version\":2,\"channels\":%d,\"sample_rate\":%d,\"samples_per_pixel\":%d,\"bits\":16,\"length\":%u,\"data\":[",
+		         _nout, samplerate, _spp, _length);
+		for (uint32_t i = 0; i < _length * 2 * _nout; ++i) {
+			fprintf (f, i > 0 ? ",%d" : "%d", _data[i]);
+		}
+		fprintf (f, "]}\n");
+	} else {
+		write_le32 (f, 2);          // version
+		write_le32 (f, 0);          // flags: 16 bit
+		write_le32 (f, samplerate);
+		write_le32 (f, _spp);
+		write_le32 (f, _length);
+		write_le32 (f, _nout);
+		for (uint32_t i = 0; i < _length * 2 * _nout; ++i) {
+			unsigned char b[2] = { (unsigned char)_data[i], (unsigned char)((uint16_t)_data[i] >> 8) };
+			fwrite (b, 1, 2, f);
+		}
+	}
+	return 0 == fclose (f);
+}
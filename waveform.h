@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2021 Robin Gareus <robin@gareus.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WAVEFORM_H
+#define _WAVEFORM_H
+
+#include <stdint.h>
+
+/* min/max waveform overview, compatible with audiowaveform's
+ * binary (.dat) and JSON data format version 2.
+ */
+class Waveform
+{
+public:
+	Waveform (void);
+	~Waveform (void);
+
+	void init (int nchan, int samples_per_pixel, bool split);
+	void fini (void);
+
+	void process (int nframes, float const* buf);
+
+	/* false if the file cannot be written, or memory ran out */
+	bool save (const char* path, int samplerate);
+
+private:
+	void flush ();
+	void reset ();
+
+	int    _nchan;
+	int    _nout;
+	int    _spp;
+	int    _cnt;
+	float  _gain;
+	float* _min;
+	float* _max;
+
+	int16_t* _data;
+	uint32_t _length;
+	uint32_t _alloc;
+	bool     _failed;
+};
+
+#endif